@@ -148,6 +148,40 @@ uint64_t get_physical_address(uint64_t va)
 	return 0;
 }
 
+/*
+ * Count the pages of [addr, addr + len) that are present in physical
+ * memory, from the same PM_PRESENT bit of `/proc/self/pagemap' that
+ * get_physical_address() checks. Entries are read in batches, so this
+ * stays cheap for mappings of millions of pages.
+ */
+uint64_t count_resident_pages(const void *addr, size_t len)
+{
+	uint64_t entries[512], first, npages, resident = 0, i;
+	ssize_t n;
+	int pmfd;
+
+	first = (uint64_t)addr / get_page_size();
+	npages = ((uint64_t)addr + len + get_page_size() - 1) / get_page_size() - first;
+
+	if (-1 == (pmfd = open(PAGEMAP_PATH, O_RDONLY)))
+		die("open(" PAGEMAP_PATH ")");
+	while (npages > 0) {
+		n = pread(pmfd, entries, (npages < 512 ? npages : 512) * sizeof(entries[0]),
+			  first * sizeof(entries[0]));
+		if (n <= 0)
+			die("pread(" PAGEMAP_PATH ")");
+		n /= sizeof(entries[0]);
+		for (i = 0; i < (uint64_t)n; i++)
+			resident += GET_BIT(entries[i], 63);
+		first += n;
+		npages -= n;
+	}
+	if (-1 == close(pmfd))
+		perror("close(" PAGEMAP_PATH ")");
+
+	return resident;
+}
+
 void press_enter(void)
 {
 	char enter = 0;
@@ -13,6 +13,7 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <stdint.h>
 
 /******************************************************************************
  * Helper Functions
@@ -57,6 +58,12 @@ void show_va_info(uint64_t va);
  */
 uint64_t get_physical_address(unsigned long virt_addr);
 
+/*
+ * Count the pages of [addr, addr + len) that are present in physical
+ * memory, according to `/proc/self/pagemap`.
+ */
+uint64_t count_resident_pages(const void *addr, size_t len);
+
 void press_enter(void);
 
 #endif /* MAP_H */
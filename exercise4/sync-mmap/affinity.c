@@ -0,0 +1,414 @@
+/*
+ * affinity.c
+ *
+ * CPU topology discovery (from /sys) and placement of worker threads
+ * or processes onto CPUs according to a placement policy.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "affinity.h"
+
+#define SYSFS_CPU	"/sys/devices/system/cpu"
+#define PATHLEN		256
+
+#ifndef MPOL_PREFERRED
+# define MPOL_PREFERRED	1
+#endif
+
+/*
+ * Read the first integer found in a sysfs file. For cpu lists
+ * such as "0-3,8-11" this is the lowest CPU of the list.
+ * Returns def if the file is missing or unreadable.
+ */
+static int sysfs_read_int(const char *path, int def)
+{
+	FILE *f;
+	int val;
+
+	f = fopen(path, "r");
+	if (!f)
+		return def;
+	if (fscanf(f, "%d", &val) != 1)
+		val = def;
+	fclose(f);
+	return val;
+}
+
+/* The NUMA node of a CPU is exposed as a "nodeN" link in its directory */
+static int sysfs_cpu_node(int cpu)
+{
+	char path[PATHLEN];
+	struct dirent *de;
+	DIR *d;
+	int node = 0;
+
+	snprintf(path, PATHLEN, SYSFS_CPU "/cpu%d", cpu);
+	d = opendir(path);
+	if (!d)
+		return 0;
+	while ((de = readdir(d)) != NULL) {
+		if (strncmp(de->d_name, "node", 4) == 0 &&
+		    sscanf(de->d_name + 4, "%d", &node) == 1)
+			break;
+	}
+	closedir(d);
+	return node;
+}
+
+/* First CPU sharing the highest level cache with this CPU */
+static int sysfs_cpu_llc(int cpu)
+{
+	char path[PATHLEN];
+	int i, level, best_level = -1, llc = cpu;
+
+	for (i = 0; ; i++) {
+		snprintf(path, PATHLEN, SYSFS_CPU "/cpu%d/cache/index%d/level", cpu, i);
+		level = sysfs_read_int(path, -1);
+		if (level < 0)
+			break;
+		if (level > best_level) {
+			best_level = level;
+			snprintf(path, PATHLEN,
+				 SYSFS_CPU "/cpu%d/cache/index%d/shared_cpu_list", cpu, i);
+			llc = sysfs_read_int(path, cpu);
+		}
+	}
+	return llc;
+}
+
+static int count_distinct(const struct cpu_topology *topo, size_t field)
+{
+	int i, j, n = 0;
+
+	for (i = 0; i < topo->ncpus; i++) {
+		int v = *(int *)((char *)&topo->cpus[i] + field);
+		for (j = 0; j < i; j++)
+			if (*(int *)((char *)&topo->cpus[j] + field) == v)
+				break;
+		if (j == i)
+			n++;
+	}
+	return n;
+}
+
+/*
+ * Discover the CPUs this process may run on and how they relate
+ * to each other. Returns 0 on success, -1 on failure.
+ */
+int topology_read(struct cpu_topology *topo)
+{
+	char path[PATHLEN];
+	cpu_set_t allowed;
+	int cpu, i, n;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+		perror("sched_getaffinity");
+		return -1;
+	}
+
+	topo->cpus = malloc(CPU_COUNT(&allowed) * sizeof(*topo->cpus));
+	if (!topo->cpus) {
+		fprintf(stderr, "Out of memory, failed to allocate topology\n");
+		return -1;
+	}
+
+	for (cpu = 0, n = 0; cpu < CPU_SETSIZE && n < CPU_COUNT(&allowed); cpu++) {
+		struct cpu_info *ci;
+
+		if (!CPU_ISSET(cpu, &allowed))
+			continue;
+		ci = &topo->cpus[n++];
+		ci->cpu = cpu;
+
+		snprintf(path, PATHLEN, SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu);
+		ci->package = sysfs_read_int(path, 0);
+		snprintf(path, PATHLEN, SYSFS_CPU "/cpu%d/topology/thread_siblings_list", cpu);
+		ci->core = sysfs_read_int(path, cpu);
+		ci->llc = sysfs_cpu_llc(cpu);
+		ci->node = sysfs_cpu_node(cpu);
+	}
+	topo->ncpus = n;
+
+	/* SMT index: how many siblings of the same core come before us */
+	for (i = 0; i < n; i++) {
+		int j;
+
+		topo->cpus[i].smt = 0;
+		for (j = 0; j < i; j++)
+			if (topo->cpus[j].core == topo->cpus[i].core)
+				topo->cpus[i].smt++;
+	}
+
+	topo->ncores = count_distinct(topo, offsetof(struct cpu_info, core));
+	topo->nllcs = count_distinct(topo, offsetof(struct cpu_info, llc));
+	topo->nnodes = count_distinct(topo, offsetof(struct cpu_info, node));
+	return 0;
+}
+
+void topology_free(struct cpu_topology *topo)
+{
+	free(topo->cpus);
+	topo->cpus = NULL;
+	topo->ncpus = 0;
+}
+
+void topology_print(const struct cpu_topology *topo, FILE *fp)
+{
+	int i;
+
+	fprintf(fp, "%d cpus, %d cores, %d llc domains, %d nodes\n",
+		topo->ncpus, topo->ncores, topo->nllcs, topo->nnodes);
+	for (i = 0; i < topo->ncpus; i++)
+		fprintf(fp, "  cpu %3d: package %d node %d llc %3d core %3d smt %d\n",
+			topo->cpus[i].cpu, topo->cpus[i].package, topo->cpus[i].node,
+			topo->cpus[i].llc, topo->cpus[i].core, topo->cpus[i].smt);
+}
+
+static const char *policy_names[] = {
+	[AFFINITY_NONE]    = "none",
+	[AFFINITY_COMPACT] = "compact",
+	[AFFINITY_SCATTER] = "scatter",
+	[AFFINITY_CORE]    = "core",
+};
+
+int affinity_parse_policy(const char *s, enum affinity_policy *policy)
+{
+	int i;
+
+	for (i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]); i++) {
+		if (strcmp(s, policy_names[i]) == 0) {
+			*policy = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char *affinity_policy_name(enum affinity_policy policy)
+{
+	return policy_names[policy];
+}
+
+int affinity_parse_domain(const char *s, enum affinity_domain *domain)
+{
+	if (strcmp(s, "llc") == 0)
+		*domain = AFFINITY_DOMAIN_LLC;
+	else if (strcmp(s, "node") == 0)
+		*domain = AFFINITY_DOMAIN_NODE;
+	else
+		return -1;
+	return 0;
+}
+
+/*
+ * Sort keys. qsort() has no context argument, so the keys are
+ * computed once into this array before sorting.
+ */
+struct cpu_key {
+	int key[5];
+	int cpu;
+};
+
+static int cpu_key_cmp(const void *a, const void *b)
+{
+	const struct cpu_key *ka = a, *kb = b;
+	int i;
+
+	for (i = 0; i < 5; i++)
+		if (ka->key[i] != kb->key[i])
+			return ka->key[i] - kb->key[i];
+	return ka->cpu - kb->cpu;
+}
+
+/* Rank of a core among the distinct cores of its LLC domain */
+static int core_rank_in_llc(const struct cpu_topology *topo, const struct cpu_info *ci)
+{
+	int i, rank = 0;
+
+	for (i = 0; i < topo->ncpus; i++)
+		if (topo->cpus[i].llc == ci->llc && topo->cpus[i].smt == 0 &&
+		    topo->cpus[i].core < ci->core)
+			rank++;
+	return rank;
+}
+
+/* Rank of an LLC domain among the distinct LLC domains of its node */
+static int llc_rank_in_node(const struct cpu_topology *topo, const struct cpu_info *ci)
+{
+	int i, j, rank = 0;
+
+	for (i = 0; i < topo->ncpus; i++) {
+		if (topo->cpus[i].node != ci->node || topo->cpus[i].llc >= ci->llc)
+			continue;
+		for (j = 0; j < i; j++)
+			if (topo->cpus[j].llc == topo->cpus[i].llc)
+				break;
+		if (j == i)
+			rank++;
+	}
+	return rank;
+}
+
+void affinity_plan(const struct cpu_topology *topo, enum affinity_policy policy,
+		   int nworkers, int cpus[])
+{
+	struct cpu_key *keys;
+	int i, n;
+
+	if (policy == AFFINITY_NONE || topo->ncpus == 0) {
+		for (i = 0; i < nworkers; i++)
+			cpus[i] = -1;
+		return;
+	}
+
+	keys = malloc(topo->ncpus * sizeof(*keys));
+	if (!keys) {
+		fprintf(stderr, "Out of memory, failed to allocate placement plan\n");
+		exit(1);
+	}
+
+	for (i = 0, n = 0; i < topo->ncpus; i++) {
+		const struct cpu_info *ci = &topo->cpus[i];
+		struct cpu_key *k = &keys[n];
+
+		switch (policy) {
+		case AFFINITY_CORE:
+			if (ci->smt != 0)
+				continue;
+			/* fall through: cores in compact order */
+		case AFFINITY_COMPACT:
+			k->key[0] = ci->node;
+			k->key[1] = ci->package;
+			k->key[2] = ci->llc;
+			k->key[3] = ci->core;
+			k->key[4] = ci->smt;
+			break;
+		case AFFINITY_SCATTER:
+			/* round-robin over nodes, then LLCs, then cores */
+			k->key[0] = ci->smt;
+			k->key[1] = core_rank_in_llc(topo, ci);
+			k->key[2] = llc_rank_in_node(topo, ci);
+			k->key[3] = ci->node;
+			k->key[4] = ci->llc;
+			break;
+		default:
+			break;
+		}
+		k->cpu = ci->cpu;
+		n++;
+	}
+
+	qsort(keys, n, sizeof(*keys), cpu_key_cmp);
+	for (i = 0; i < nworkers; i++)
+		cpus[i] = keys[i % n].cpu;
+	free(keys);
+}
+
+static const struct cpu_info *cpu_find(const struct cpu_topology *topo, int cpu)
+{
+	int i;
+
+	for (i = 0; i < topo->ncpus; i++)
+		if (topo->cpus[i].cpu == cpu)
+			return &topo->cpus[i];
+	return NULL;
+}
+
+int affinity_node_of_cpu(const struct cpu_topology *topo, int cpu)
+{
+	const struct cpu_info *ci = cpu_find(topo, cpu);
+
+	return ci ? ci->node : 0;
+}
+
+int affinity_pin_thread(pthread_t thread, int cpu)
+{
+	cpu_set_t set;
+	int ret;
+
+	if (cpu < 0)
+		return 0;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	ret = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if (ret) {
+		errno = ret;
+		perror("pthread_setaffinity_np");
+		return -1;
+	}
+	return 0;
+}
+
+int affinity_pin_process(pid_t pid, int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0)
+		return 0;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(pid, sizeof(set), &set) < 0) {
+		perror("sched_setaffinity");
+		return -1;
+	}
+	return 0;
+}
+
+int affinity_pin_domain(const struct cpu_topology *topo, const int cpus[], int n,
+			enum affinity_domain domain)
+{
+	const struct cpu_info *ci, *cj;
+	cpu_set_t set;
+	int i, j, any = 0;
+
+	CPU_ZERO(&set);
+	for (i = 0; i < n; i++) {
+		if (cpus[i] < 0)
+			continue;
+		any = 1;
+		CPU_SET(cpus[i], &set);
+		if ((ci = cpu_find(topo, cpus[i])) == NULL)
+			continue;
+		for (j = 0; j < topo->ncpus; j++) {
+			cj = &topo->cpus[j];
+			if (domain == AFFINITY_DOMAIN_LLC ? cj->llc == ci->llc : cj->node == ci->node)
+				CPU_SET(cj->cpu, &set);
+		}
+	}
+	if (!any)
+		return 0;
+	if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+		perror("sched_setaffinity");
+		return -1;
+	}
+	return 0;
+}
+
+int affinity_bind_memory(const struct cpu_topology *topo, void *addr, size_t len, int node)
+{
+#ifdef SYS_mbind
+	unsigned long mask;
+
+	if (topo->nnodes <= 1 || node < 0 || node >= 8 * sizeof(mask))
+		return 0;
+
+	mask = 1UL << node;
+	if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, 8 * sizeof(mask), 0) < 0) {
+		perror("mbind");
+		return -1;
+	}
+#endif
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * affinity.h
+ *
+ * CPU topology discovery (from /sys) and placement of worker threads
+ * or processes onto CPUs according to a placement policy.
+ *
+ */
+
+#ifndef AFFINITY_H__
+#define AFFINITY_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/*
+ * Placement policies:
+ *   none:    leave placement to the scheduler
+ *   compact: fill SMT siblings, then cores of the same LLC, then nodes
+ *   scatter: spread workers over LLC domains / nodes as far as possible
+ *   core:    one worker per physical core (no SMT siblings shared)
+ */
+enum affinity_policy {
+	AFFINITY_NONE,
+	AFFINITY_COMPACT,
+	AFFINITY_SCATTER,
+	AFFINITY_CORE
+};
+
+/* The CPUs a group of workers (a process of threads) is confined to */
+enum affinity_domain {
+	AFFINITY_DOMAIN_LLC,	/* CPUs sharing a last level cache */
+	AFFINITY_DOMAIN_NODE	/* CPUs of a NUMA node */
+};
+
+/* One logical CPU, as seen in /sys/devices/system/cpu/cpuN */
+struct cpu_info {
+	int cpu;	/* logical CPU number */
+	int package;	/* physical_package_id */
+	int core;	/* first CPU of thread_siblings_list */
+	int llc;	/* first CPU sharing the last level cache */
+	int node;	/* NUMA node, 0 if unknown */
+	int smt;	/* index among the SMT siblings of its core */
+};
+
+struct cpu_topology {
+	int ncpus;
+	int ncores;
+	int nllcs;
+	int nnodes;
+	struct cpu_info *cpus;	/* only CPUs we are allowed to run on */
+};
+
+int topology_read(struct cpu_topology *topo);
+void topology_free(struct cpu_topology *topo);
+void topology_print(const struct cpu_topology *topo, FILE *fp);
+
+int affinity_parse_policy(const char *s, enum affinity_policy *policy);
+const char *affinity_policy_name(enum affinity_policy policy);
+int affinity_parse_domain(const char *s, enum affinity_domain *domain);
+
+/*
+ * Fill cpus[0..nworkers-1] with the CPU each worker should run on.
+ * Entries are -1 for AFFINITY_NONE. Workers wrap around when there
+ * are more workers than CPUs (or cores, for AFFINITY_CORE).
+ */
+void affinity_plan(const struct cpu_topology *topo, enum affinity_policy policy,
+		   int nworkers, int cpus[]);
+
+/* NUMA node of a logical CPU, 0 if unknown. */
+int affinity_node_of_cpu(const struct cpu_topology *topo, int cpu);
+
+/* Pin a thread / process to one CPU; a negative cpu is a no-op. */
+int affinity_pin_thread(pthread_t thread, int cpu);
+int affinity_pin_process(pid_t pid, int cpu);
+
+/*
+ * Pin the calling process to every CPU in the LLC domain (or NUMA node)
+ * of any of cpus[0..n-1], so that its threads may move between them.
+ * Negative entries are ignored; a no-op if all are negative.
+ */
+int affinity_pin_domain(const struct cpu_topology *topo, const int cpus[], int n,
+			enum affinity_domain domain);
+
+/*
+ * Ask the kernel to place the pages of [addr, addr + len) on the given
+ * NUMA node. Must be called before the pages are first touched.
+ * A no-op (returning 0) on single-node machines.
+ */
+int affinity_bind_memory(const struct cpu_topology *topo, void *addr, size_t len, int node);
+
+#endif /* AFFINITY_H__ */
@@ -0,0 +1,138 @@
+/*
+ * backend-c11.c
+ *
+ * C11 <threads.h> backend: the same turn-taking as pthread-cond,
+ * written with thrd_t, mtx_t and cnd_t, and the same gate keeping the
+ * threads from starting work until all of them are up. Left out of the
+ * backend table if the C library has no <threads.h>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#ifndef __STDC_NO_THREADS__
+# include <threads.h>
+#endif
+
+#include "backend.h"
+
+#ifndef __STDC_NO_THREADS__
+
+struct c11_ctx {
+	struct mandel_job *job;
+	mtx_t mutex;
+	cnd_t cond;
+	int gate;		/* 0 until all start, then 1, or -1 to quit */
+	int next_unit;
+};
+
+struct c11_worker {
+	struct c11_ctx *ctx;
+	int id;
+	thrd_t tid;
+};
+
+static int c11_worker(void *arg)
+{
+	struct c11_worker *w = arg;
+	struct c11_ctx *ctx = w->ctx;
+	struct mandel_job *job = ctx->job;
+	int u, gate;
+
+	mtx_lock(&ctx->mutex);
+	while ((gate = ctx->gate) == 0)
+		cnd_wait(&ctx->cond, &ctx->mutex);
+	mtx_unlock(&ctx->mutex);
+	if (gate < 0)
+		return 0;
+	/* on Linux a thrd_t is a pthread_t */
+	affinity_pin_thread(pthread_self(), job->cpus[w->id]);
+	for (u = job_first_unit(job, w->id); u < job->grid.ntiles; u = job_next_unit(job, u)) {
+		compute_unit(job, u);
+
+		mtx_lock(&ctx->mutex);
+		while (ctx->next_unit != u)
+			cnd_wait(&ctx->cond, &ctx->mutex);
+		output_unit(job, u);
+		ctx->next_unit++;
+		cnd_broadcast(&ctx->cond);
+		mtx_unlock(&ctx->mutex);
+	}
+	return 0;
+}
+
+static int render_c11(struct mandel_job *job)
+{
+	struct c11_ctx ctx = { .job = job, .next_unit = 0 };
+	struct c11_worker *workers;
+	int i, n, ret, err = 0;
+
+	workers = malloc(job->nworkers * sizeof(*workers));
+	if (workers == NULL) {
+		fprintf(stderr, "Out of memory, failed to allocate %d workers\n", job->nworkers);
+		errno = ENOMEM;
+		return -1;
+	}
+	if (mtx_init(&ctx.mutex, mtx_plain) != thrd_success) {
+		fprintf(stderr, "c11: failed to initialize mutex\n");
+		free(workers);
+		errno = EAGAIN;
+		return -1;
+	}
+	if (cnd_init(&ctx.cond) != thrd_success) {
+		fprintf(stderr, "c11: failed to initialize condition\n");
+		mtx_destroy(&ctx.mutex);
+		free(workers);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	for (n = 0; n < job->nworkers; n++) {
+		workers[n].ctx = &ctx;
+		workers[n].id = n;
+		ret = thrd_create(&workers[n].tid, c11_worker, &workers[n]);
+		if (ret != thrd_success) {
+			fprintf(stderr, "thrd_create failed\n");
+			err = ret == thrd_nomem ? ENOMEM : EAGAIN;
+			break;
+		}
+	}
+	/* let them start, or send home the ones that did if not all could */
+	mtx_lock(&ctx.mutex);
+	ctx.gate = err ? -1 : 1;
+	cnd_broadcast(&ctx.cond);
+	mtx_unlock(&ctx.mutex);
+	for (i = 0; i < n; i++)
+		thrd_join(workers[i].tid, NULL);
+
+	cnd_destroy(&ctx.cond);
+	mtx_destroy(&ctx.mutex);
+	free(workers);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+#else
+
+static int render_c11(struct mandel_job *job)
+{
+	fprintf(stderr, "c11: the C library has no <threads.h>\n");
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif /* __STDC_NO_THREADS__ */
+
+const struct backend backend_c11 = {
+	.name = "c11",
+	.desc = "C11 <threads.h>, mutex and condition variable",
+	.ordered = 1,
+	.shared_frame = 0,
+	.in_process = 1,
+	.render = render_c11,
+};
@@ -0,0 +1,271 @@
+/*
+ * backend-farm.c
+ *
+ * Render farm coordinator: the tiles of the frame are sent to the
+ * workers listed in job->farm, up to FARM_WINDOW of them in flight per
+ * worker. A worker gets its next tile when it returns one, so faster
+ * (or less loaded) workers get more tiles. The tiles of a worker that
+ * hangs up, or stays silent for FARM_TIMEOUT_MS, go back to the
+ * pending ones and are handed to the others.
+ *
+ * Workers return iteration counts, which are colored here unless the
+ * job wants them as they are. Rows are printed in order as their tiles
+ * come back.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "farm.h"
+#include "tune.h"
+
+#define UNIT_PENDING	-1
+#define UNIT_DONE	-2
+
+struct farm_worker {
+	const char *addr;
+	int fd;			/* -1 once the worker is gone */
+	int inflight;
+	double last;		/* last sign of life while owing tiles */
+};
+
+struct farm {
+	struct mandel_job *job;
+	struct farm_worker *w;
+	int nworkers;
+	int *state;		/* per unit: UNIT_PENDING, UNIT_DONE or its worker */
+	int low;		/* no pending unit below this one */
+	unsigned char *buf;	/* an encoded reply */
+};
+
+static void farm_drop(struct farm *f, int i, const char *why)
+{
+	struct farm_worker *w = &f->w[i];
+	int u;
+
+	fprintf(stderr, "farm: lost worker %s (%s), reassigning %d tiles\n",
+		w->addr, why, w->inflight);
+	close(w->fd);
+	w->fd = -1;
+	w->inflight = 0;
+	for (u = 0; u < f->job->grid.ntiles; u++) {
+		if (f->state[u] == i) {
+			f->state[u] = UNIT_PENDING;
+			if (u < f->low)
+				f->low = u;
+		}
+	}
+}
+
+static int farm_next_pending(struct farm *f)
+{
+	while (f->low < f->job->grid.ntiles && f->state[f->low] != UNIT_PENDING)
+		f->low++;
+	return f->low < f->job->grid.ntiles ? f->low : -1;
+}
+
+/* Top up the window of every worker, lowest units first */
+static void farm_assign(struct farm *f)
+{
+	unsigned char buf[FARM_REQ_SIZE];
+	struct farm_req req;
+	struct farm_worker *w;
+	int i, u, more = 1;
+
+	req.vp = f->job->vp;
+	/* one tile per worker per round, so that the first rows spread out */
+	while (more) {
+		more = 0;
+		for (i = 0; i < f->nworkers; i++) {
+			w = &f->w[i];
+			if (w->fd < 0 || w->inflight >= FARM_WINDOW)
+				continue;
+			if ((u = farm_next_pending(f)) < 0)
+				return;
+
+			req.unit = u;
+			tile_get(&f->job->grid, u, &req.t);
+			farm_pack_req(&req, buf);
+			if (farm_write(w->fd, buf, sizeof(buf)) < 0) {
+				farm_drop(f, i, strerror(errno));
+				continue;
+			}
+			f->state[u] = i;
+			if (w->inflight++ == 0)
+				w->last = tune_now();
+			more = 1;
+		}
+	}
+}
+
+/* Read one reply of worker i into the frame */
+static int farm_receive(struct farm *f, int i)
+{
+	struct farm_worker *w = &f->w[i];
+	unsigned char hdr[FARM_REP_SIZE];
+	uint32_t magic, unit, len;
+	struct tile t;
+	int *dst, j, k;
+
+	if (farm_read(w->fd, hdr, sizeof(hdr)) < 0)
+		return -1;
+	memcpy(&magic, hdr, 4);
+	memcpy(&unit, hdr + 4, 4);
+	memcpy(&len, hdr + 8, 4);
+	magic = ntohl(magic);
+	unit = ntohl(unit);
+	len = ntohl(len);
+	if (magic != FARM_REP_MAGIC || unit >= (uint32_t)f->job->grid.ntiles ||
+	    f->state[unit] != i)
+		return -1;
+
+	tile_get(&f->job->grid, unit, &t);
+	if (len > FARM_ENC_MAX((size_t)t.w * t.h) || farm_read(w->fd, f->buf, len) < 0)
+		return -1;
+	dst = frame_row(f->job->frame, t.y0) + t.x0;
+	if (farm_decode(f->buf, len, dst, f->job->frame->pitch, t.w, t.h,
+			f->job->vp.max_iter) < 0)
+		return -1;
+	if (!f->job->iterations)
+		for (j = 0; j < t.h; j++, dst += f->job->frame->pitch)
+			for (k = 0; k < t.w; k++)
+				dst[k] = mandel_palette(dst[k]);
+
+	f->state[unit] = UNIT_DONE;
+	w->inflight--;
+	w->last = tune_now();
+	return 0;
+}
+
+static int farm_connect_all(struct farm *f, char *list)
+{
+	char *addr, *save;
+	int n = 0, live = 0;
+
+	for (addr = list; *addr; addr++)
+		n += *addr == ',';
+	f->w = calloc(n + 1, sizeof(*f->w));
+	if (f->w == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	for (addr = strtok_r(list, ",", &save); addr; addr = strtok_r(NULL, ",", &save)) {
+		f->w[f->nworkers].addr = addr;
+		f->w[f->nworkers].fd = farm_connect(addr);
+		if (f->w[f->nworkers].fd >= 0)
+			live++;
+		f->nworkers++;
+	}
+	return live;
+}
+
+/* Wait up to a second for replies, but not past the deadline */
+static int poll_timeout(const struct mandel_job *job)
+{
+	double left;
+
+	if (job->ctl == NULL || job->ctl->deadline == 0)
+		return 1000;
+	left = (job->ctl->deadline - tune_now()) * 1000;
+	return left < 0 ? 0 : left > 1000 ? 1000 : (int)left + 1;
+}
+
+static int render_farm(struct mandel_job *job)
+{
+	struct farm f = { .job = job };
+	struct pollfd pfd[64];
+	int idx[64];
+	char *list;
+	double now;
+	int i, n, u, next = 0, ret = -1;
+
+	if (job->farm == NULL) {
+		fprintf(stderr, "farm: no workers, use -F address[,address...]\n");
+		return -1;
+	}
+	list = strdup(job->farm);
+	f.state = malloc(job->grid.ntiles * sizeof(*f.state));
+	f.buf = malloc(FARM_ENC_MAX((size_t)job->grid.tile_w * job->grid.tile_h));
+	if (list == NULL || f.state == NULL || f.buf == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	for (u = 0; u < job->grid.ntiles; u++)
+		f.state[u] = UNIT_PENDING;
+
+	if (farm_connect_all(&f, list) == 0) {
+		fprintf(stderr, "farm: no worker could be reached\n");
+		goto out;
+	}
+	if (f.nworkers > 64) {
+		fprintf(stderr, "farm: at most 64 workers\n");
+		goto out;
+	}
+
+	while (next < job->grid.ntiles) {
+		farm_assign(&f);
+
+		for (i = n = 0; i < f.nworkers; i++) {
+			if (f.w[i].fd >= 0 && f.w[i].inflight > 0) {
+				pfd[n].fd = f.w[i].fd;
+				pfd[n].events = POLLIN;
+				idx[n++] = i;
+			}
+		}
+		if (n == 0) {
+			fprintf(stderr, "farm: all workers are gone\n");
+			goto out;
+		}
+		if (poll(pfd, n, poll_timeout(job)) < 0 && errno != EINTR) {
+			perror("poll");
+			goto out;
+		}
+
+		for (i = 0; i < n; i++)
+			if (pfd[i].revents && farm_receive(&f, idx[i]) < 0)
+				farm_drop(&f, idx[i], "connection lost or bad reply");
+		now = tune_now();
+		for (i = 0; i < f.nworkers; i++)
+			if (f.w[i].fd >= 0 && f.w[i].inflight > 0 &&
+			    (now - f.w[i].last) * 1000 > FARM_TIMEOUT_MS)
+				farm_drop(&f, i, "timed out");
+
+		/* out of time: approximate what the workers still owe us */
+		if (job->ctl && render_expired(job->ctl)) {
+			for (u = next; u < job->grid.ntiles; u++) {
+				if (f.state[u] != UNIT_DONE) {
+					compute_unit(job, u);
+					f.state[u] = UNIT_DONE;
+				}
+			}
+		}
+
+		while (next < job->grid.ntiles && f.state[next] == UNIT_DONE)
+			output_unit(job, next++);
+	}
+	ret = 0;
+out:
+	for (i = 0; i < f.nworkers; i++)
+		if (f.w[i].fd >= 0)
+			close(f.w[i].fd);
+	free(f.w);
+	free(f.buf);
+	free(f.state);
+	free(list);
+	return ret;
+}
+
+const struct backend backend_farm = {
+	.name = "farm",
+	.desc = "tiles sent to `mandel -L' workers over sockets (-F)",
+	.ordered = 1,
+	.shared_frame = 0,
+	.render = render_farm,
+};
@@ -0,0 +1,314 @@
+/*
+ * backend-fork.c
+ *
+ * Process backends. The frame is a shared memory area, so the rows
+ * computed by the children are visible to everyone:
+ *
+ *   fork-shm: children only compute; the parent waits for all of
+ *             them and then prints the frame.
+ *   fork-sem: children take turns printing, through a ring of
+ *             process-shared semaphores in a shared memory area.
+ *   fork-stream: children only compute their round-robin share and
+ *             flag every unit done; the parent prints rows in order
+ *             as soon as they are done, checking while it waits that
+ *             the children are still alive: a unit of one that died
+ *             would never be done, so the frame fails instead.
+ *   fork-queue: as fork-stream, but children pull chunks of units
+ *             from a shared atomic work queue.
+ *
+ *   fork-threads: hybrid; processes of job->threads threads each,
+ *             every process pinned to the LLC domain or NUMA node of
+ *             its threads' CPUs. Processes compute their static share
+ *             of the units (that of their threads), the threads of a
+ *             process pull units of that share from a local counter,
+ *             and the parent prints as in fork-stream.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/types.h>
+
+#include "backend.h"
+#include "workq.h"
+#include "tune.h"
+
+/* How often a parent waiting on its children checks they are alive */
+#define CHILD_CHECK_MS	100
+
+/* Number of processes running `threads' workers each */
+static int nprocs(const struct mandel_job *job, int threads)
+{
+	return (job->nworkers + threads - 1) / threads;
+}
+
+/*
+ * Create one child per `threads' workers; each one pins itself and runs
+ * fn(job, i). A child of a single worker is pinned to that worker's CPU,
+ * one of several to the domain of their CPUs. The pids of the children
+ * are stored in pids, unless it is NULL.
+ */
+static void fork_workers(struct mandel_job *job, int threads,
+			 void (*fn)(struct mandel_job *, int, void *), void *arg,
+			 pid_t *pids)
+{
+	pid_t child_pid;
+	int i, first, n;
+	double start = tune_now();
+
+	for (i = 0; i < nprocs(job, threads); i++) {
+		child_pid = fork();
+		if (child_pid < 0) {
+			perror("error with creation of child");
+			exit(1);
+		}
+		if (child_pid == 0) {
+			first = i * threads;
+			n = job->nworkers - first < threads ? job->nworkers - first : threads;
+			if (n == 1)
+				affinity_pin_process(0, job->cpus[first]);
+			else
+				affinity_pin_domain(job->topo, job->cpus + first, n, job->domain);
+			fn(job, i, arg);
+			exit(0);
+		}
+		if (pids)
+			pids[i] = child_pid;
+	}
+	job->spawn_time += tune_now() - start;
+}
+
+static void shm_execute(struct mandel_job *job, int proc, void *arg)
+{
+	int u;
+
+	//every process writes to the buffer
+	for (u = job_first_unit(job, proc); u < job->grid.ntiles; u = job_next_unit(job, u))
+		compute_unit(job, u);
+}
+
+static int render_shm(struct mandel_job *job)
+{
+	fork_workers(job, 1, shm_execute, NULL, NULL);
+	if (backend_wait_children(job->nworkers) < 0)
+		return -1;
+	output_frame(job);
+	return 0;
+}
+
+static void sem_execute(struct mandel_job *job, int proc, void *arg)
+{
+	sem_t *sem = arg;
+	int u;
+
+	for (u = job_first_unit(job, proc); u < job->grid.ntiles; u = job_next_unit(job, u)) {
+		compute_unit(job, u);
+		if (sem_wait(&sem[proc]) < 0) {
+			perror("sem_wait");
+			exit(1);
+		}
+		output_unit(job, u);
+		if (u + 1 < job->grid.ntiles && sem_post(&sem[job_owner(job, u + 1)]) < 0) {
+			perror("sem_post");
+			exit(1);
+		}
+	}
+}
+
+static int render_sem(struct mandel_job *job)
+{
+	sem_t *sem;
+	int i, ret;
+
+	//allocate shared mem to store semaphore array
+	sem = create_shared_memory_area(job->nworkers * sizeof(sem_t));
+	for (i = 0; i < job->nworkers; i++) {
+		if (sem_init(&sem[i], 1, i == job_owner(job, 0)) < 0) {
+			perror("sem_init");
+			exit(1);
+		}
+	}
+
+	fork_workers(job, 1, sem_execute, sem, NULL);
+	ret = backend_wait_children(job->nworkers);
+
+	for (i = 0; i < job->nworkers; i++)
+		sem_destroy(&sem[i]);
+	destroy_shared_memory_area(sem, job->nworkers * sizeof(sem_t));
+	return ret;
+}
+
+static void stream_execute(struct mandel_job *job, int proc, void *arg)
+{
+	struct workq *q = arg;
+	int u;
+
+	for (u = job_first_unit(job, proc); u < job->grid.ntiles; u = job_next_unit(job, u)) {
+		compute_unit(job, u);
+		workq_complete(q, u);
+	}
+}
+
+static void queue_execute(struct mandel_job *job, int proc, void *arg)
+{
+	struct workq *q = arg;
+	int u, first, last;
+
+	while (workq_take(q, &first, &last) == 0) {
+		for (u = first; u < last; u++) {
+			compute_unit(job, u);
+			workq_complete(q, u);
+		}
+	}
+}
+
+/*
+ * Hybrid: the threads of process `proc' share the units owned by its
+ * workers through a process-local counter over that list.
+ */
+struct hybrid_proc {
+	struct mandel_job *job;
+	struct workq *q;
+	int *units;
+	int nunits;
+	int next;
+};
+
+static void *hybrid_thread(void *arg)
+{
+	struct hybrid_proc *hp = arg;
+	int i;
+
+	while ((i = __atomic_fetch_add(&hp->next, 1, __ATOMIC_RELAXED)) < hp->nunits) {
+		compute_unit(hp->job, hp->units[i]);
+		workq_complete(hp->q, hp->units[i]);
+	}
+	return NULL;
+}
+
+static void hybrid_execute(struct mandel_job *job, int proc, void *arg)
+{
+	struct hybrid_proc hp = { job, arg, NULL, 0, 0 };
+	int first = proc * job->threads;
+	int last = first + job->threads < job->nworkers ? first + job->threads : job->nworkers;
+	pthread_t tid[last - first];
+	int u, i, ret;
+
+	hp.units = malloc(job->grid.ntiles * sizeof(int));
+	if (hp.units == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	for (u = 0; u < job->grid.ntiles; u++)
+		if (job_owner(job, u) >= first && job_owner(job, u) < last)
+			hp.units[hp.nunits++] = u;
+
+	/* this process is the first of its threads */
+	for (i = 1; i < last - first; i++) {
+		ret = pthread_create(&tid[i], NULL, hybrid_thread, &hp);
+		if (ret) {
+			errno = ret;
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	hybrid_thread(&hp);
+	for (i = 1; i < last - first; i++)
+		pthread_join(tid[i], NULL);
+	free(hp.units);
+}
+
+/*
+ * The parent is the only printer: it sleeps on the flag of the next
+ * unit in order and prints its rows as soon as it is done, while the
+ * children are still computing the rest. A child that dies leaves its
+ * units undone for good, so the parent wakes up now and then to check
+ * on them, and gives up on the frame (killing the others) if one did.
+ */
+static int render_printer(struct mandel_job *job, int threads,
+			  void (*fn)(struct mandel_job *, int, void *))
+{
+	struct workq *q;
+	pid_t *pids;
+	int u, n = nprocs(job, threads), ret = 0;
+
+	pids = malloc(n * sizeof(*pids));
+	if (pids == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	q = workq_create(job->grid.ntiles, job->chunk);
+	fork_workers(job, threads, fn, q, pids);
+
+	for (u = 0; u < job->grid.ntiles && ret == 0; u++) {
+		while (ret == 0 && workq_wait_timeout(q, u, CHILD_CHECK_MS) < 0)
+			ret = backend_poll_children(pids, n);
+		if (ret == 0)
+			output_unit(job, u);
+	}
+
+	if (backend_reap_children(pids, n, ret < 0) < 0)
+		ret = -1;
+	workq_destroy(q);
+	free(pids);
+	return ret;
+}
+
+static int render_stream(struct mandel_job *job)
+{
+	return render_printer(job, 1, stream_execute);
+}
+
+static int render_queue(struct mandel_job *job)
+{
+	return render_printer(job, 1, queue_execute);
+}
+
+static int render_hybrid(struct mandel_job *job)
+{
+	return render_printer(job, job->threads, hybrid_execute);
+}
+
+const struct backend backend_fork_shm = {
+	.name = "fork-shm",
+	.desc = "processes, shared frame printed by the parent",
+	.ordered = 0,
+	.shared_frame = 1,
+	.render = render_shm,
+};
+
+const struct backend backend_fork_sem = {
+	.name = "fork-sem",
+	.desc = "processes, ring of process-shared semaphores",
+	.ordered = 1,
+	.shared_frame = 1,
+	.render = render_sem,
+};
+
+const struct backend backend_fork_stream = {
+	.name = "fork-stream",
+	.desc = "processes, parent prints rows as they are flagged done",
+	.ordered = 1,
+	.shared_frame = 1,
+	.render = render_stream,
+};
+
+const struct backend backend_fork_queue = {
+	.name = "fork-queue",
+	.desc = "processes, shared atomic work queue",
+	.ordered = 1,
+	.shared_frame = 1,
+	.render = render_queue,
+};
+
+const struct backend backend_fork_threads = {
+	.name = "fork-threads",
+	.desc = "processes of threads (-T), one domain per process",
+	.ordered = 1,
+	.shared_frame = 1,
+	.render = render_hybrid,
+};
@@ -0,0 +1,51 @@
+/*
+ * backend-omp.c
+ *
+ * OpenMP backend: a parallel loop over the units with the same static
+ * round-robin chunking as the other backends, and an `ordered' region
+ * for printing. Compiled with -fopenmp; without it the backend is left
+ * out of the backend table.
+ *
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+
+#include "backend.h"
+
+static int render_omp(struct mandel_job *job)
+{
+#ifdef _OPENMP
+	int u;
+
+	#pragma omp parallel num_threads(job->nworkers)
+	{
+		affinity_pin_thread(pthread_self(), job->cpus[omp_get_thread_num()]);
+
+		#pragma omp for ordered schedule(static, job->chunk)
+		for (u = 0; u < job->grid.ntiles; u++) {
+			compute_unit(job, u);
+			#pragma omp ordered
+			output_unit(job, u);
+		}
+	}
+	return 0;
+#else
+	fprintf(stderr, "omp: built without OpenMP support\n");
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+const struct backend backend_omp = {
+	.name = "omp",
+	.desc = "OpenMP parallel for, ordered output",
+	.ordered = 1,
+	.shared_frame = 0,
+	.in_process = 1,
+	.render = render_omp,
+};
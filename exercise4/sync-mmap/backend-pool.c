@@ -0,0 +1,55 @@
+/*
+ * backend-pool.c
+ *
+ * Prefork pool backend: the workers are started once (with the spawn
+ * method of the job) and serve every following frame of the same
+ * shape, so batch renders pay the fork cost only once.
+ *
+ */
+
+#include <stdio.h>
+
+#include "backend.h"
+#include "pool.h"
+
+static struct pool *pool;
+
+static int render_pool(struct mandel_job *job)
+{
+	double spawn_time;
+
+	if (pool && !pool_fits(pool, job)) {
+		pool_destroy(pool);
+		pool = NULL;
+	}
+	if (pool == NULL) {
+		pool = pool_create(job->nworkers, job->cpus, job->spawn,
+				   job->frame->width, job->frame->height, job->frame->pitch,
+				   job->grid.ntiles, &spawn_time);
+		if (pool == NULL)
+			return -1;
+		job->spawn_time += spawn_time;
+	}
+	if (pool_run(pool, job) < 0) {
+		pool_destroy(pool);
+		pool = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static void cleanup_pool(void)
+{
+	if (pool)
+		pool_destroy(pool);
+	pool = NULL;
+}
+
+const struct backend backend_fork_pool = {
+	.name = "fork-pool",
+	.desc = "prefork pool of processes kept across frames",
+	.ordered = 1,
+	.shared_frame = 0,
+	.render = render_pool,
+	.cleanup = cleanup_pool,
+};
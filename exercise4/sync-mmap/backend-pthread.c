@@ -0,0 +1,210 @@
+/*
+ * backend-pthread.c
+ *
+ * POSIX threads backends. Every thread computes its units and then
+ * waits for its turn to print them:
+ *
+ *   pthread-sem:  one semaphore per thread, each thread posts the
+ *                 semaphore of the owner of the next unit.
+ *   pthread-cond: a mutex-protected `next unit to print' counter and
+ *                 a condition variable broadcast whenever it moves.
+ *
+ * Both run inside libmandel too, so failures are returned rather than
+ * exiting: the threads wait at a gate until all of them are started,
+ * and if one could not be, the others are sent home through it.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "backend.h"
+
+#define perror_pthread(ret, msg) \
+	do { errno = ret; perror(msg); } while (0)
+
+struct pthread_ctx {
+	struct mandel_job *job;
+	sem_t *sem;			/* pthread-sem */
+	pthread_mutex_t mutex;		/* the gate, and pthread-cond */
+	pthread_cond_t cond;
+	int gate;			/* 0 until all start, then 1, or -1 to quit */
+	int next_unit;
+};
+
+struct pthread_worker {
+	struct pthread_ctx *ctx;
+	int id;
+	pthread_t tid;
+};
+
+/* Wait until every thread is started; 0 if all were, -1 otherwise */
+static int pass_gate(struct pthread_ctx *ctx)
+{
+	int gate;
+
+	pthread_mutex_lock(&ctx->mutex);
+	while (ctx->gate == 0)
+		pthread_cond_wait(&ctx->cond, &ctx->mutex);
+	gate = ctx->gate;
+	pthread_mutex_unlock(&ctx->mutex);
+	return gate > 0 ? 0 : -1;
+}
+
+static void *sem_worker(void *arg)
+{
+	struct pthread_worker *w = arg;
+	struct mandel_job *job = w->ctx->job;
+	sem_t *sem = w->ctx->sem;
+	int u, ret;
+
+	if (pass_gate(w->ctx) < 0)
+		return NULL;
+	affinity_pin_thread(pthread_self(), job->cpus[w->id]);
+	for (u = job_first_unit(job, w->id); u < job->grid.ntiles; u = job_next_unit(job, u)) {
+		compute_unit(job, u);
+		/* a signal handler of the program we are in may interrupt it */
+		while ((ret = sem_wait(&sem[w->id])) < 0 && errno == EINTR)
+			;
+		if (ret < 0) {
+			perror("sem_wait");
+			exit(1);
+		}
+		output_unit(job, u);
+		if (u + 1 < job->grid.ntiles && sem_post(&sem[job_owner(job, u + 1)]) < 0) {
+			perror("sem_post");
+			exit(1);
+		}
+	}
+	return NULL;
+}
+
+static void *cond_worker(void *arg)
+{
+	struct pthread_worker *w = arg;
+	struct pthread_ctx *ctx = w->ctx;
+	struct mandel_job *job = ctx->job;
+	int u;
+
+	if (pass_gate(ctx) < 0)
+		return NULL;
+	affinity_pin_thread(pthread_self(), job->cpus[w->id]);
+	for (u = job_first_unit(job, w->id); u < job->grid.ntiles; u = job_next_unit(job, u)) {
+		/* compute outside the lock, only printing is serialized */
+		compute_unit(job, u);
+
+		pthread_mutex_lock(&ctx->mutex);
+		while (ctx->next_unit != u)
+			pthread_cond_wait(&ctx->cond, &ctx->mutex);
+		output_unit(job, u);
+		ctx->next_unit++;
+		pthread_cond_broadcast(&ctx->cond);
+		pthread_mutex_unlock(&ctx->mutex);
+	}
+	return NULL;
+}
+
+/* Run nworkers threads of fn; -1 with errno set if they could not all start */
+static int run_threads(struct pthread_ctx *ctx, void *(*fn)(void *))
+{
+	struct pthread_worker *workers;
+	int i, n, ret, err = 0, nworkers = ctx->job->nworkers;
+
+	workers = malloc(nworkers * sizeof(*workers));
+	if (workers == NULL) {
+		fprintf(stderr, "Out of memory, failed to allocate %d workers\n", nworkers);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	pthread_mutex_init(&ctx->mutex, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
+	ctx->gate = 0;
+	for (n = 0; n < nworkers; n++) {
+		workers[n].ctx = ctx;
+		workers[n].id = n;
+		ret = pthread_create(&workers[n].tid, NULL, fn, &workers[n]);
+		if (ret) {
+			perror_pthread(ret, "pthread_create");
+			err = ret;
+			break;
+		}
+	}
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->gate = err ? -1 : 1;
+	pthread_cond_broadcast(&ctx->cond);
+	pthread_mutex_unlock(&ctx->mutex);
+
+	for (i = 0; i < n; i++) {
+		ret = pthread_join(workers[i].tid, NULL);
+		if (ret)
+			perror_pthread(ret, "pthread_join");
+	}
+
+	pthread_cond_destroy(&ctx->cond);
+	pthread_mutex_destroy(&ctx->mutex);
+	free(workers);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+static int render_sem(struct mandel_job *job)
+{
+	struct pthread_ctx ctx = { .job = job };
+	int i, ret, err;
+
+	ctx.sem = malloc(job->nworkers * sizeof(sem_t));
+	if (ctx.sem == NULL) {
+		fprintf(stderr, "Out of memory, failed to allocate semaphores\n");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* the owner of the first unit may print immediately */
+	for (i = 0; i < job->nworkers; i++) {
+		if (sem_init(&ctx.sem[i], 0, i == job_owner(job, 0)) < 0) {
+			perror("sem_init");
+			break;
+		}
+	}
+
+	ret = i < job->nworkers ? -1 : run_threads(&ctx, sem_worker);
+
+	err = errno;
+	while (i--)
+		sem_destroy(&ctx.sem[i]);
+	free(ctx.sem);
+	errno = err;
+	return ret;
+}
+
+static int render_cond(struct mandel_job *job)
+{
+	struct pthread_ctx ctx = { .job = job, .next_unit = 0 };
+
+	return run_threads(&ctx, cond_worker);
+}
+
+const struct backend backend_pthread_sem = {
+	.name = "pthread-sem",
+	.desc = "threads, one semaphore per thread",
+	.ordered = 1,
+	.shared_frame = 0,
+	.in_process = 1,
+	.render = render_sem,
+};
+
+const struct backend backend_pthread_cond = {
+	.name = "pthread-cond",
+	.desc = "threads, mutex and condition variable",
+	.ordered = 1,
+	.shared_frame = 0,
+	.in_process = 1,
+	.render = render_cond,
+};
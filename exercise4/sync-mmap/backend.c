@@ -0,0 +1,113 @@
+/*
+ * backend.c
+ *
+ * The table of execution backends.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "backend.h"
+
+static const struct backend *backends[] = {
+	&backend_pthread_sem,
+	&backend_pthread_cond,
+	&backend_fork_shm,
+	&backend_fork_sem,
+	&backend_fork_stream,
+	&backend_fork_queue,
+	&backend_fork_threads,
+	&backend_fork_pool,
+	&backend_farm,
+#ifdef _OPENMP
+	&backend_omp,
+#endif
+#ifndef __STDC_NO_THREADS__
+	&backend_c11,
+#endif
+	NULL
+};
+
+const struct backend *backend_find(const char *name)
+{
+	int i;
+
+	for (i = 0; backends[i]; i++)
+		if (strcmp(backends[i]->name, name) == 0)
+			return backends[i];
+	return NULL;
+}
+
+void backend_list(FILE *fp)
+{
+	int i;
+
+	for (i = 0; backends[i]; i++)
+		fprintf(fp, "       %-12s %s\n", backends[i]->name, backends[i]->desc);
+}
+
+int backend_wait_children(int nchildren)
+{
+	int i, status, ret = 0;
+
+	for (i = 0; i < nchildren; i++) {
+		if (wait(&status) < 0) {
+			perror("wait");
+			return -1;
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			ret = -1;
+	}
+	if (ret < 0)
+		fprintf(stderr, "some children failed to render their rows\n");
+	return ret;
+}
+
+int backend_poll_children(pid_t *pids, int n)
+{
+	int i, status, ret = 0;
+	pid_t pid;
+
+	for (i = 0; i < n; i++) {
+		if (pids[i] <= 0)
+			continue;
+		pid = waitpid(pids[i], &status, WNOHANG);
+		if (pid == 0)
+			continue;
+		if (pid < 0) {
+			perror("waitpid");
+			ret = -1;
+		} else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			ret = -1;
+		}
+		pids[i] = 0;
+	}
+	if (ret < 0)
+		fprintf(stderr, "some children failed to render their rows\n");
+	return ret;
+}
+
+int backend_reap_children(pid_t *pids, int n, int kill_them)
+{
+	int i, status, ret = 0;
+
+	for (i = 0; i < n; i++) {
+		if (pids[i] <= 0)
+			continue;
+		if (kill_them)
+			kill(pids[i], SIGKILL);
+		if (waitpid(pids[i], &status, 0) < 0) {
+			perror("waitpid");
+			ret = -1;
+		} else if (!kill_them && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+			ret = -1;
+		}
+		pids[i] = 0;
+	}
+	if (ret < 0)
+		fprintf(stderr, "some children failed to render their rows\n");
+	return ret;
+}
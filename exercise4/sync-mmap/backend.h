@@ -0,0 +1,71 @@
+/*
+ * backend.h
+ *
+ * Execution backends: different ways of running the workers of a
+ * render job (threads or processes, and how they take turns printing
+ * rows), all sharing the same work and output paths from render.c.
+ *
+ */
+
+#ifndef BACKEND_H__
+#define BACKEND_H__
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "render.h"
+
+struct backend {
+	const char *name;
+	const char *desc;
+	/*
+	 * Ordered backends print rows while rendering and need units in
+	 * TILE_ORDER_ROWS; the others print the frame once it is done.
+	 */
+	int ordered;
+	/* The frame must be MAP_SHARED, the workers are processes */
+	int shared_frame;
+	/*
+	 * The workers are threads of this process, started and gone within
+	 * render(): safe to run inside another program (see libmandel.h)
+	 */
+	int in_process;
+	/* Render the job; returns 0 on success, -1 on failure */
+	int (*render)(struct mandel_job *job);
+	/* Release whatever outlives a render (worker pools); may be NULL */
+	void (*cleanup)(void);
+};
+
+extern const struct backend backend_pthread_sem;
+extern const struct backend backend_pthread_cond;
+extern const struct backend backend_fork_shm;
+extern const struct backend backend_fork_sem;
+extern const struct backend backend_fork_stream;
+extern const struct backend backend_fork_queue;
+extern const struct backend backend_fork_threads;
+extern const struct backend backend_fork_pool;
+extern const struct backend backend_farm;
+extern const struct backend backend_omp;
+extern const struct backend backend_c11;
+
+const struct backend *backend_find(const char *name);
+void backend_list(FILE *fp);
+
+/* Wait for nchildren children and complain about failed ones */
+int backend_wait_children(int nchildren);
+
+/*
+ * For waits on children that would never end if one died: reap those
+ * of the n children in pids that have exited, setting their pid to 0,
+ * and complain and return -1 if one of them failed, 0 otherwise.
+ */
+int backend_poll_children(pid_t *pids, int n);
+
+/*
+ * Wait for the children in pids that were not reaped yet, killing
+ * them first if kill_them is set. Returns -1 if one of them failed
+ * (killed ones do not count), 0 otherwise.
+ */
+int backend_reap_children(pid_t *pids, int n, int kill_them);
+
+#endif /* BACKEND_H__ */
@@ -0,0 +1,263 @@
+/*
+ * batch.c
+ *
+ * Batch rendering. The tiles of all jobs form one queue, job after job,
+ * and every thread takes the next tile until the queue is empty: there
+ * is no barrier between jobs, so while the last tiles of a job are
+ * being computed the other threads are already on the next one. A
+ * job's frame is allocated when its first tile is taken, and written
+ * and freed by whichever thread computes its last tile.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../helpers/mandel-lib.h"
+#include "batch.h"
+#include "tune.h"
+
+struct batch_job {
+	struct mandel_job job;
+	struct frame frame;
+	pthread_mutex_t lock;		/* taken to allocate the frame */
+	char output[PATH_MAX];
+	int first;			/* its first tile in the queue */
+	int remaining;			/* tiles not computed yet */
+	double start, end;		/* first tile taken, output written */
+	int failed;
+};
+
+struct batch {
+	struct batch_job *jobs;
+	int njobs;
+	int ntiles;
+	int next;			/* next tile in the queue */
+	const int *cpus;
+	double start;
+};
+
+struct batch_worker {
+	struct batch *b;
+	int id;
+	pthread_t tid;
+};
+
+/*************
+ * Job files *
+ *************/
+
+static int parse_jobs(const char *path, const struct mandel_job *tmpl, int tile_w, int tile_h,
+		      struct batch *b)
+{
+	double xmin, xmax, ymin, ymax;
+	struct batch_job *j;
+	char *line = NULL, size[64], output[PATH_MAX];
+	size_t len = 0;
+	int lineno = 0, width, height, max_iter, n, ret = 0;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (getline(&line, &len, fp) > 0) {
+		lineno++;
+		if (sscanf(line, " %c", size) != 1 || size[0] == '#')
+			continue;
+		n = sscanf(line, "%lf %lf %lf %lf %63s %d %4095s",
+			   &xmin, &xmax, &ymin, &ymax, size, &max_iter, output);
+		if (n != 7 || tile_parse_size(size, &width, &height) < 0 ||
+		    xmin >= xmax || ymin >= ymax || max_iter <= 0) {
+			fprintf(stderr, "%s:%d: expected `xmin xmax ymin ymax WxH max_iter output'\n",
+				path, lineno);
+			ret = -1;
+			break;
+		}
+
+		j = realloc(b->jobs, (b->njobs + 1) * sizeof(*b->jobs));
+		if (j == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		b->jobs = j;
+		j = &b->jobs[b->njobs++];
+		memset(j, 0, sizeof(*j));
+		j->job = *tmpl;
+		j->job.vp = (struct viewport){ xmin, ymax, (xmax - xmin) / width,
+					       (ymax - ymin) / height, max_iter };
+		if (tile_w)
+			tile_grid_init(&j->job.grid, width, height, tile_w, tile_h, TILE_ORDER_ROWS);
+		else
+			tile_grid_init(&j->job.grid, width, height, width, 1, TILE_ORDER_ROWS);
+		j->job.fd = -1;
+		j->job.topo = NULL;	/* the frame is not bound to any node */
+		j->first = b->ntiles;
+		j->remaining = j->job.grid.ntiles;
+		strcpy(j->output, output);
+		b->ntiles += j->job.grid.ntiles;
+	}
+	free(line);
+	fclose(fp);
+	if (ret == 0 && b->njobs == 0) {
+		fprintf(stderr, "%s: no jobs\n", path);
+		ret = -1;
+	}
+	return ret;
+}
+
+/**********
+ * Output *
+ **********/
+
+static int write_output(struct batch_job *j)
+{
+	const struct frame *f = &j->frame;
+	size_t len = strlen(j->output);
+	unsigned char *row;
+	char header[64];
+	int fd, r, c, n, ret = 0;
+
+	fd = open(j->output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(j->output);
+		return -1;
+	}
+	if (len > 4 && strcmp(j->output + len - 4, ".pgm") == 0) {
+		n = snprintf(header, sizeof(header), "P5\n%d %d\n255\n", f->width, f->height);
+		row = malloc(f->width);
+		if (row == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		ret = insist_write(fd, header, n) == n ? 0 : -1;
+		for (r = 0; r < f->height && ret == 0; r++) {
+			for (c = 0; c < f->width; c++)
+				row[c] = frame_row(f, r)[c];
+			if (insist_write(fd, (char *)row, f->width) != f->width)
+				ret = -1;
+		}
+		free(row);
+	} else {
+		for (r = 0; r < f->height; r++)
+			output_mandel_line(fd, frame_row(f, r), f->width);
+		reset_xterm_color(fd);
+	}
+	if (ret < 0)
+		perror(j->output);
+	if (close(fd) < 0) {
+		perror(j->output);
+		ret = -1;
+	}
+	return ret;
+}
+
+/***********
+ * Workers *
+ ***********/
+
+/* The job tile n of the queue belongs to */
+static struct batch_job *find_job(const struct batch *b, int n)
+{
+	int lo = 0, hi = b->njobs - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (b->jobs[mid].first <= n)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return &b->jobs[lo];
+}
+
+static void *batch_worker(void *arg)
+{
+	struct batch_worker *w = arg;
+	struct batch *b = w->b;
+	struct batch_job *j;
+	int n;
+
+	affinity_pin_thread(pthread_self(), b->cpus[w->id]);
+	while ((n = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->ntiles) {
+		j = find_job(b, n);
+		pthread_mutex_lock(&j->lock);
+		if (j->frame.base == NULL) {
+			frame_alloc(&j->frame, j->job.grid.width, j->job.grid.height, 0);
+			j->start = tune_now();
+		}
+		pthread_mutex_unlock(&j->lock);
+
+		compute_unit(&j->job, n - j->first);
+
+		/* the last tile of the job: every other tile is in the frame */
+		if (__atomic_sub_fetch(&j->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+			j->failed = write_output(j) < 0;
+			frame_free(&j->frame);
+			j->end = tune_now();
+		}
+	}
+	return NULL;
+}
+
+int batch_run(const char *path, const struct mandel_job *tmpl, int tile_w, int tile_h)
+{
+	struct batch b = { 0 };
+	struct batch_worker *workers;
+	struct batch_job *j;
+	double elapsed, pixels = 0;
+	int i, ret, failed = 0;
+
+	if (parse_jobs(path, tmpl, tile_w, tile_h, &b) < 0) {
+		free(b.jobs);
+		return -1;
+	}
+	for (i = 0; i < b.njobs; i++) {
+		b.jobs[i].job.frame = &b.jobs[i].frame;
+		pthread_mutex_init(&b.jobs[i].lock, NULL);
+	}
+	b.cpus = tmpl->cpus;
+
+	workers = malloc(tmpl->nworkers * sizeof(*workers));
+	if (workers == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	b.start = tune_now();
+	for (i = 0; i < tmpl->nworkers; i++) {
+		workers[i].b = &b;
+		workers[i].id = i;
+		ret = pthread_create(&workers[i].tid, NULL, batch_worker, &workers[i]);
+		if (ret) {
+			errno = ret;
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (i = 0; i < tmpl->nworkers; i++)
+		pthread_join(workers[i].tid, NULL);
+	elapsed = tune_now() - b.start;
+
+	for (i = 0; i < b.njobs; i++) {
+		j = &b.jobs[i];
+		fprintf(stderr, "job %d: %dx%d, %d iterations -> %s: done at %.4fs, "
+			"%.4fs from first tile%s\n",
+			i + 1, j->job.grid.width, j->job.grid.height, j->job.vp.max_iter, j->output,
+			j->end - b.start, j->end - j->start, j->failed ? " (FAILED)" : "");
+		pixels += (double)j->job.grid.width * j->job.grid.height;
+		failed += j->failed;
+		pthread_mutex_destroy(&j->lock);
+	}
+	fprintf(stderr, "batch: %d jobs, %d tiles, %d threads: %.4fs, %.2f jobs/s, %.2f Mpixels/s\n",
+		b.njobs, b.ntiles, tmpl->nworkers, elapsed, b.njobs / elapsed, pixels / elapsed / 1e6);
+
+	free(workers);
+	free(b.jobs);
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,30 @@
+/*
+ * batch.h
+ *
+ * Batch rendering: many views from a job file, rendered in one process
+ * by one pool of threads working through a single queue of tiles.
+ *
+ */
+
+#ifndef BATCH_H__
+#define BATCH_H__
+
+#include "render.h"
+
+/*
+ * Render every job of the job file at path. One job per line:
+ *
+ *   xmin xmax ymin ymax WxH max_iter output
+ *
+ * Blank lines and lines starting with `#' are skipped. An output ending
+ * in .pgm gets a PGM image of the color values, any other gets what
+ * mandel prints on a terminal.
+ *
+ * tmpl supplies the worker count, their CPUs and the tile cache; tiles
+ * are tile_w x tile_h, or full rows if tile_w is 0. Per-job latency and
+ * the total throughput are reported on stderr. Returns 0 on success,
+ * -1 if the job file is invalid or an output could not be written.
+ */
+int batch_run(const char *path, const struct mandel_job *tmpl, int tile_w, int tile_h);
+
+#endif /* BATCH_H__ */
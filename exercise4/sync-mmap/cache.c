@@ -0,0 +1,513 @@
+/*
+ * cache.c
+ *
+ * The tile cache file is laid out as
+ *
+ *   header | index: nentries entries | block chains | blocks
+ *
+ * The index is an open addressing hash table (linear probing, with
+ * backward shift deletion, so there are no tombstones) whose entries
+ * are also linked into an LRU list. A tile's encoded pixels are kept
+ * in a chain of fixed-size blocks; free blocks form a list of their own.
+ *
+ * Tiles are keyed by fractal mode, zoom level (the pixel steps), the
+ * tile's origin on the plane and size, and the iteration cap. The
+ * origin is taken exactly as the tile is drawn, so a hit is
+ * byte-identical to what computing the tile would give.
+ *
+ * Pixels are stored as the zigzag-encoded difference from the previous
+ * pixel, as a varint: neighbouring pixels mostly share a color, so
+ * most take one byte.
+ *
+ * A robust, process-shared mutex in the header serializes all access;
+ * decoding and encoding happen outside it.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+#define CACHE_MAGIC	0x3143544d	/* "MTC1" */
+#define CACHE_VERSION	1
+#define CACHE_BLOCK	256		/* bytes of encoded pixels per block */
+#define NONE		UINT32_MAX
+
+struct cache_key {
+	double xstep, ystep;	/* zoom level */
+	double x, ymax;		/* left column as drawn, top of the viewport */
+	uint32_t mode;
+	uint32_t max_iter;
+	uint32_t y0, w, h;
+	uint32_t pad;		/* keys are compared with memcmp() */
+};
+
+struct cache_entry {
+	struct cache_key key;
+	uint64_t hash;		/* 0 for an empty slot */
+	uint32_t prev, next;	/* LRU list, most recently used first */
+	uint32_t len;		/* encoded bytes */
+	uint32_t first;		/* first block */
+};
+
+struct cache_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;		/* of the file */
+	uint32_t nentries;	/* a power of two */
+	uint32_t nblocks;
+	uint32_t count;		/* entries in use */
+	uint32_t nfree;
+	uint32_t free;		/* free block list */
+	uint32_t head, tail;	/* LRU list */
+	uint64_t hits, misses, evictions;
+	uint64_t entries_off, chain_off, blocks_off;
+	pthread_mutex_t lock;
+};
+
+struct cache {
+	struct cache_hdr *h;
+	struct cache_entry *e;
+	uint32_t *chain;	/* next block of every block */
+	unsigned char *blocks;
+	size_t size;
+	uint64_t hits, misses, evictions;	/* at cache_open() */
+};
+
+/************
+ * Encoding *
+ ************/
+
+static size_t encode(const int *src, size_t pitch, int w, int h, unsigned char *dst)
+{
+	uint32_t z;
+	size_t len = 0;
+	int i, j, prev = 0, d;
+
+	for (j = 0; j < h; j++, src += pitch) {
+		for (i = 0; i < w; i++) {
+			d = src[i] - prev;
+			prev = src[i];
+			z = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+			while (z >= 0x80) {
+				dst[len++] = z | 0x80;
+				z >>= 7;
+			}
+			dst[len++] = z;
+		}
+	}
+	return len;
+}
+
+static int decode(const unsigned char *src, size_t len, int *dst, size_t pitch, int w, int h)
+{
+	uint32_t z;
+	size_t k = 0;
+	int i, j, shift, prev = 0;
+
+	for (j = 0; j < h; j++, dst += pitch) {
+		for (i = 0; i < w; i++) {
+			z = 0;
+			shift = 0;
+			do {
+				if (k >= len || shift > 28)
+					return -1;
+				z |= (uint32_t)(src[k] & 0x7f) << shift;
+				shift += 7;
+			} while (src[k++] & 0x80);
+			prev += (int)(z >> 1) ^ -(int)(z & 1);
+			dst[i] = prev;
+		}
+	}
+	return k == len ? 0 : -1;
+}
+
+/*********
+ * Index *
+ *********/
+
+static void make_key(const struct viewport *vp, const struct tile *t, struct cache_key *key)
+{
+	memset(key, 0, sizeof(*key));
+	key->xstep = vp->xstep;
+	key->ystep = vp->ystep;
+	key->x = tile_xstart(vp, t);
+	key->ymax = vp->ymax;
+	key->mode = CACHE_MODE_MANDEL;
+	key->max_iter = vp->max_iter;
+	key->y0 = t->y0;
+	key->w = t->w;
+	key->h = t->h;
+}
+
+/* FNV-1a; never 0, which marks an empty slot */
+static uint64_t hash_key(const struct cache_key *key)
+{
+	const unsigned char *p = (const unsigned char *)key;
+	uint64_t h = 14695981039346656037ULL;
+	size_t i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		h = (h ^ p[i]) * 1099511628211ULL;
+	return h ? h : 1;
+}
+
+static uint32_t find(struct cache *c, const struct cache_key *key, uint64_t hash)
+{
+	uint32_t mask = c->h->nentries - 1, i;
+
+	for (i = hash & mask; c->e[i].hash; i = (i + 1) & mask)
+		if (c->e[i].hash == hash && memcmp(&c->e[i].key, key, sizeof(*key)) == 0)
+			return i;
+	return NONE;
+}
+
+static void lru_unlink(struct cache *c, uint32_t i)
+{
+	struct cache_entry *e = &c->e[i];
+
+	if (e->prev != NONE)
+		c->e[e->prev].next = e->next;
+	else
+		c->h->head = e->next;
+	if (e->next != NONE)
+		c->e[e->next].prev = e->prev;
+	else
+		c->h->tail = e->prev;
+}
+
+static void lru_push(struct cache *c, uint32_t i)
+{
+	c->e[i].prev = NONE;
+	c->e[i].next = c->h->head;
+	if (c->h->head != NONE)
+		c->e[c->h->head].prev = i;
+	else
+		c->h->tail = i;
+	c->h->head = i;
+}
+
+/* Move entry j to the empty slot i, keeping the LRU list pointing at it */
+static void move_entry(struct cache *c, uint32_t i, uint32_t j)
+{
+	struct cache_entry *e = &c->e[i];
+
+	*e = c->e[j];
+	if (e->prev != NONE)
+		c->e[e->prev].next = i;
+	else
+		c->h->head = i;
+	if (e->next != NONE)
+		c->e[e->next].prev = i;
+	else
+		c->h->tail = i;
+}
+
+static void evict(struct cache *c, uint32_t i)
+{
+	uint32_t mask = c->h->nentries - 1, j, k, b, next;
+
+	/* blocks back to the free list */
+	for (b = c->e[i].first; b != NONE; b = next) {
+		next = c->chain[b];
+		c->chain[b] = c->h->free;
+		c->h->free = b;
+		c->h->nfree++;
+	}
+	lru_unlink(c, i);
+	c->h->count--;
+
+	/* backward shift: pull later entries of the probe run into the hole */
+	for (j = (i + 1) & mask; c->e[j].hash; j = (j + 1) & mask) {
+		k = c->e[j].hash & mask;
+		if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+			move_entry(c, i, j);
+			i = j;
+		}
+	}
+	c->e[i].hash = 0;
+}
+
+/********************
+ * Opening, locking *
+ ********************/
+
+/* Empty the cache */
+static void cache_clear(struct cache *c)
+{
+	struct cache_hdr *h = c->h;
+	uint32_t b;
+
+	memset(c->e, 0, (size_t)h->nentries * sizeof(*c->e));
+	for (b = 0; b < h->nblocks; b++)
+		c->chain[b] = b + 1 < h->nblocks ? b + 1 : NONE;
+	h->free = 0;
+	h->nfree = h->nblocks;
+	h->count = 0;
+	h->head = h->tail = NONE;
+	h->hits = h->misses = h->evictions = 0;
+}
+
+static void cache_init(struct cache *c)
+{
+	pthread_mutexattr_t attr;
+
+	cache_clear(c);
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&c->h->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void cache_lock(struct cache *c)
+{
+	if (pthread_mutex_lock(&c->h->lock) == EOWNERDEAD) {
+		/* someone died halfway through an update: start afresh */
+		fprintf(stderr, "cache: recovering from a dead owner, clearing\n");
+		cache_clear(c);
+		pthread_mutex_consistent(&c->h->lock);
+	}
+}
+
+static void cache_unlock(struct cache *c)
+{
+	pthread_mutex_unlock(&c->h->lock);
+}
+
+/* Fit the index and blocks into size bytes */
+static int cache_layout(struct cache_hdr *h, size_t size)
+{
+	size_t off = (sizeof(*h) + 63) / 64 * 64, per;
+	uint64_t n;
+
+	per = sizeof(struct cache_entry) + sizeof(uint32_t) + CACHE_BLOCK;
+	if (size < off + 16 * per)
+		return -1;
+	/* an entry for every block, rounded down to a power of two */
+	for (n = 1; n * 2 <= (size - off) / per; n *= 2)
+		;
+	h->nentries = n;
+	h->entries_off = off;
+	off += n * sizeof(struct cache_entry);
+	h->nblocks = (size - off) / (sizeof(uint32_t) + CACHE_BLOCK);
+	h->chain_off = off;
+	h->blocks_off = off + (size_t)h->nblocks * sizeof(uint32_t);
+	return 0;
+}
+
+/* As in checkpoint.c: a header a crash left before its magic */
+static int unfinished(const struct cache_hdr *h, off_t size)
+{
+	static const struct cache_hdr zero;
+
+	return h->magic == 0 && (memcmp(h, &zero, sizeof(*h)) == 0 ||
+		(h->version == CACHE_VERSION && h->size == (uint64_t)size));
+}
+
+struct cache *cache_open(const char *path, size_t size)
+{
+	struct cache *c;
+	struct stat st;
+	int fd, fresh;
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+	/* one opener at a time decides whether to initialize */
+	if (flock(fd, LOCK_EX) < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		close(fd);
+		return NULL;
+	}
+	c = calloc(1, sizeof(*c));
+	if (c == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	fresh = st.st_size == 0;
+	if (!fresh) {
+		struct cache_hdr h;
+
+		if (pread(fd, &h, sizeof(h), 0) != sizeof(h)) {
+			fprintf(stderr, "%s: not a cache, refusing to overwrite it\n", path);
+			goto fail;
+		} else if (unfinished(&h, st.st_size)) {
+			fresh = 1;
+		} else if (h.magic != CACHE_MAGIC || h.version != CACHE_VERSION ||
+			   h.size != (uint64_t)st.st_size) {
+			fprintf(stderr, "%s: not a cache of this mandel, refusing to "
+				"overwrite it\n", path);
+			goto fail;
+		} else {
+			size = st.st_size;
+		}
+	}
+	if (fresh && (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0)) {
+		perror(path);
+		goto fail;
+	}
+
+	c->size = size;
+	c->h = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (c->h == MAP_FAILED) {
+		perror("cache: mmap");
+		goto fail;
+	}
+	if (fresh) {
+		if (cache_layout(c->h, size) < 0) {
+			fprintf(stderr, "cache: %zu bytes is too small\n", size);
+			munmap(c->h, size);
+			goto fail;
+		}
+		c->h->size = size;
+		c->h->version = CACHE_VERSION;
+	}
+	c->e = (struct cache_entry *)((char *)c->h + c->h->entries_off);
+	c->chain = (uint32_t *)((char *)c->h + c->h->chain_off);
+	c->blocks = (unsigned char *)c->h + c->h->blocks_off;
+	if (fresh) {
+		cache_init(c);
+		c->h->magic = CACHE_MAGIC;
+		msync(c->h, size, MS_ASYNC);
+	}
+
+	c->hits = c->h->hits;
+	c->misses = c->h->misses;
+	c->evictions = c->h->evictions;
+	close(fd);	/* drops the flock too; the mapping stays */
+	return c;
+
+fail:
+	close(fd);
+	free(c);
+	return NULL;
+}
+
+void cache_close(struct cache *c)
+{
+	munmap(c->h, c->size);
+	free(c);
+}
+
+/***************
+ * Get and put *
+ ***************/
+
+int cache_get(struct cache *c, const struct viewport *vp, const struct tile *t,
+	      int *dst, size_t pitch)
+{
+	struct cache_key key;
+	unsigned char *buf;
+	uint64_t hash;
+	uint32_t i, b;
+	size_t len, off, n;
+
+	make_key(vp, t, &key);
+	hash = hash_key(&key);
+
+	cache_lock(c);
+	if ((i = find(c, &key, hash)) == NONE) {
+		c->h->misses++;
+		cache_unlock(c);
+		return -1;
+	}
+	len = c->e[i].len;
+	buf = malloc(len ? len : 1);
+	if (buf == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	for (b = c->e[i].first, off = 0; off < len; b = c->chain[b], off += n) {
+		n = len - off < CACHE_BLOCK ? len - off : CACHE_BLOCK;
+		memcpy(buf + off, c->blocks + (size_t)b * CACHE_BLOCK, n);
+	}
+	lru_unlink(c, i);
+	lru_push(c, i);
+	c->h->hits++;
+	cache_unlock(c);
+
+	if (decode(buf, len, dst, pitch, t->w, t->h) < 0) {
+		/* cannot happen unless the file was tampered with */
+		free(buf);
+		return -1;
+	}
+	free(buf);
+	return 0;
+}
+
+void cache_put(struct cache *c, const struct viewport *vp, const struct tile *t,
+	       const int *src, size_t pitch)
+{
+	struct cache_key key;
+	struct cache_entry *e;
+	unsigned char *buf;
+	uint64_t hash;
+	uint32_t i, b, need, mask = c->h->nentries - 1;
+	size_t len, off, n;
+
+	/* 5 bytes is the longest varint of a 32 bit difference */
+	buf = malloc((size_t)t->w * t->h * 5);
+	if (buf == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	len = encode(src, pitch, t->w, t->h, buf);
+	need = (len + CACHE_BLOCK - 1) / CACHE_BLOCK;
+	make_key(vp, t, &key);
+	hash = hash_key(&key);
+
+	cache_lock(c);
+	if (need > c->h->nblocks / 2 || find(c, &key, hash) != NONE)
+		goto out;	/* too big to be worth it, or raced in by another worker */
+
+	/* keep the table at most 3/4 full so probe runs stay short */
+	while (c->h->nfree < need || c->h->count + 1 > c->h->nentries / 4 * 3) {
+		evict(c, c->h->tail);
+		c->h->evictions++;
+	}
+
+	for (i = hash & mask; c->e[i].hash; i = (i + 1) & mask)
+		;
+	e = &c->e[i];
+	e->key = key;
+	e->hash = hash;
+	e->len = len;
+	e->first = need ? c->h->free : NONE;
+	for (off = 0, b = NONE; off < len; off += n) {
+		b = c->h->free;
+		c->h->free = c->chain[b];
+		c->h->nfree--;
+		n = len - off < CACHE_BLOCK ? len - off : CACHE_BLOCK;
+		memcpy(c->blocks + (size_t)b * CACHE_BLOCK, buf + off, n);
+	}
+	if (b != NONE)
+		c->chain[b] = NONE;
+	lru_push(c, i);
+	c->h->count++;
+out:
+	cache_unlock(c);
+	free(buf);
+}
+
+void cache_print_stats(const struct cache *c, FILE *fp)
+{
+	fprintf(fp, "cache: %llu hits, %llu misses, %llu evictions; %u tiles, %u/%u blocks free\n",
+		(unsigned long long)(c->h->hits - c->hits),
+		(unsigned long long)(c->h->misses - c->misses),
+		(unsigned long long)(c->h->evictions - c->evictions),
+		c->h->count, c->h->nfree, c->h->nblocks);
+}
@@ -0,0 +1,50 @@
+/*
+ * cache.h
+ *
+ * A persistent tile cache: computed tiles, compressed, in one mmap'ed
+ * file of fixed size, shared by every process and thread that opens it
+ * and kept across runs. The least recently used tiles are evicted when
+ * it is full.
+ *
+ */
+
+#ifndef CACHE_H__
+#define CACHE_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "tile.h"
+
+/* Fractal modes; a tile of one mode never matches a tile of another */
+#define CACHE_MODE_MANDEL	0
+
+#define CACHE_SIZE_DEFAULT	(64UL << 20)
+/* Environment variable overriding the size of a new cache, in MB */
+#define CACHE_SIZE_ENV		"MANDEL_CACHE_MB"
+
+struct cache;
+
+/*
+ * Open the cache in path, creating it in an empty file, or one a crash
+ * left half initialized. An existing valid cache keeps its size.
+ * Returns NULL on error, or if path holds anything else.
+ */
+struct cache *cache_open(const char *path, size_t size);
+void cache_close(struct cache *c);
+
+/*
+ * Look tile t of viewport vp up and on a hit write its pixels to dst
+ * (pitch as in compute_mandel_tile()); returns 0 on a hit, -1 on a miss.
+ */
+int cache_get(struct cache *c, const struct viewport *vp, const struct tile *t,
+	      int *dst, size_t pitch);
+
+/* Store a computed tile, evicting old tiles to make room */
+void cache_put(struct cache *c, const struct viewport *vp, const struct tile *t,
+	       const int *src, size_t pitch);
+
+/* Hits, misses and evictions since cache_open() */
+void cache_print_stats(const struct cache *c, FILE *fp);
+
+#endif /* CACHE_H__ */
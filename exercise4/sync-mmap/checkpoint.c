@@ -0,0 +1,240 @@
+/*
+ * checkpoint.c
+ *
+ * The checkpoint file is laid out as
+ *
+ *   header | bitmap: a bit per unit | frame: height rows of pitch ints
+ *
+ * with the bitmap and the frame each starting on a page of their own.
+ * The header holds the view and the grid the file was made for; a
+ * checkpoint of anything else is refused rather than resumed.
+ *
+ * Crash consistency rests on ordering alone. A unit's rows are
+ * msync()ed before its bit is set, and the kernel may write the
+ * bitmap back whenever it likes after that: whatever survives a
+ * crash, a set bit means the pixels were on disk first. A unit caught
+ * half way, or one whose bit did not make it, is simply computed
+ * again. A new file gets its header synced, and its magic written
+ * last, before any unit is committed.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC	0x3150434d	/* "MCP1" */
+#define CHECKPOINT_VERSION	1
+#define CACHE_LINE		64
+
+struct checkpoint_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;		/* of the file */
+	struct viewport vp;
+	uint32_t width, height;
+	uint32_t tile_w, tile_h;
+	uint32_t order;
+	uint32_t ntiles;
+	uint32_t iterations;	/* the frame holds counts, not colors */
+	uint64_t pitch;		/* in ints */
+	uint64_t bitmap_off, frame_off;
+};
+
+struct checkpoint {
+	struct checkpoint_hdr *h;
+	uint64_t *bitmap;
+	size_t size;
+	size_t page;
+	int fd;			/* kept open for its flock */
+};
+
+static size_t round_up(size_t n, size_t to)
+{
+	return (n + to - 1) / to * to;
+}
+
+/* Whether the header describes vp and grid */
+static int same_view(const struct checkpoint_hdr *h, const struct viewport *vp,
+		     const struct tile_grid *grid, int iterations)
+{
+	return h->vp.xmin == vp->xmin && h->vp.ymax == vp->ymax &&
+	       h->vp.xstep == vp->xstep && h->vp.ystep == vp->ystep &&
+	       h->vp.max_iter == vp->max_iter &&
+	       h->width == (uint32_t)grid->width && h->height == (uint32_t)grid->height &&
+	       h->tile_w == (uint32_t)grid->tile_w && h->tile_h == (uint32_t)grid->tile_h &&
+	       h->order == (uint32_t)grid->order && h->ntiles == (uint32_t)grid->ntiles &&
+	       h->iterations == (uint32_t)iterations;
+}
+
+static void layout(struct checkpoint_hdr *h, const struct viewport *vp,
+		   const struct tile_grid *grid, int iterations, size_t page)
+{
+	memset(h, 0, sizeof(*h));
+	h->version = CHECKPOINT_VERSION;
+	h->vp = *vp;
+	h->width = grid->width;
+	h->height = grid->height;
+	h->tile_w = grid->tile_w;
+	h->tile_h = grid->tile_h;
+	h->order = grid->order;
+	h->ntiles = grid->ntiles;
+	h->iterations = iterations;
+	h->pitch = round_up(grid->width * sizeof(int), CACHE_LINE) / sizeof(int);
+	h->bitmap_off = round_up(sizeof(*h), page);
+	h->frame_off = h->bitmap_off + round_up((grid->ntiles + 63) / 64 * sizeof(uint64_t), page);
+	h->size = h->frame_off + round_up(h->pitch * grid->height * sizeof(int), page);
+}
+
+/*
+ * A header a crash left before its magic was synced: all zeros if it
+ * came right after the file was sized, whole but for the magic if after
+ * the fsync. Only these, and empty files, are ours to initialize.
+ */
+static int unfinished(const struct checkpoint_hdr *h, off_t size)
+{
+	static const struct checkpoint_hdr zero;
+
+	return h->magic == 0 && (memcmp(h, &zero, sizeof(*h)) == 0 ||
+		(h->version == CHECKPOINT_VERSION && h->size == (uint64_t)size));
+}
+
+struct checkpoint *checkpoint_open(const char *path, const struct viewport *vp,
+				   const struct tile_grid *grid, int iterations,
+				   struct frame *frame)
+{
+	struct checkpoint_hdr want, h;
+	struct checkpoint *c;
+	struct stat st;
+	int fd, fresh;
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+	/* one render per checkpoint: two would commit each other's units */
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		close(fd);
+		return NULL;
+	}
+	c = calloc(1, sizeof(*c));
+	if (c == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	c->page = sysconf(_SC_PAGE_SIZE);
+	layout(&want, vp, grid, iterations, c->page);
+
+	fresh = st.st_size == 0;
+	if (!fresh) {
+		if (pread(fd, &h, sizeof(h), 0) != sizeof(h)) {
+			fprintf(stderr, "%s: not a checkpoint, refusing to overwrite it\n", path);
+			goto fail;
+		} else if (unfinished(&h, st.st_size)) {
+			fprintf(stderr, "%s: checkpoint never finished, starting afresh\n", path);
+			fresh = 1;
+		} else if (h.magic != CHECKPOINT_MAGIC || h.version != CHECKPOINT_VERSION ||
+			   h.size != (uint64_t)st.st_size) {
+			fprintf(stderr, "%s: not a checkpoint of this mandel, refusing to "
+				"overwrite it\n", path);
+			goto fail;
+		} else if (!same_view(&h, vp, grid, iterations) || h.pitch < h.width) {
+			fprintf(stderr, "%s: checkpoint of another view, tile grid or coloring; "
+				"remove it to start over\n", path);
+			goto fail;
+		} else {
+			want = h;
+		}
+	}
+	if (fresh && (ftruncate(fd, 0) < 0 || ftruncate(fd, want.size) < 0)) {
+		perror(path);
+		goto fail;
+	}
+
+	c->size = want.size;
+	c->h = mmap(NULL, c->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (c->h == MAP_FAILED) {
+		perror("checkpoint: mmap");
+		goto fail;
+	}
+	if (fresh) {
+		/* everything but the magic on disk first, then the magic */
+		*c->h = want;
+		if (fsync(fd) < 0) {
+			perror(path);
+			munmap(c->h, c->size);
+			goto fail;
+		}
+		c->h->magic = CHECKPOINT_MAGIC;
+		msync(c->h, c->page, MS_SYNC);
+	}
+	c->bitmap = (uint64_t *)((char *)c->h + c->h->bitmap_off);
+
+	memset(frame, 0, sizeof(*frame));
+	frame->base = (int *)((char *)c->h + c->h->frame_off);
+	frame->pitch = c->h->pitch;
+	frame->width = grid->width;
+	frame->height = grid->height;
+	frame->flags = FRAME_SHARED;
+	frame->mapped = c->size - c->h->frame_off;
+	frame->pub_fd = -1;
+	c->fd = fd;
+	return c;
+
+fail:
+	close(fd);
+	free(c);
+	return NULL;
+}
+
+void checkpoint_close(struct checkpoint *c)
+{
+	size_t len = c->h->frame_off - c->h->bitmap_off;
+
+	if (msync(c->bitmap, len, MS_SYNC) < 0)
+		perror("checkpoint: msync");
+	munmap(c->h, c->size);
+	close(c->fd);
+	free(c);
+}
+
+int checkpoint_done(const struct checkpoint *c, int unit)
+{
+	return __atomic_load_n(&c->bitmap[unit / 64], __ATOMIC_ACQUIRE) >> (unit % 64) & 1;
+}
+
+void checkpoint_commit(struct checkpoint *c, int unit, const struct tile *t)
+{
+	const char *frame = (const char *)c->h + c->h->frame_off;
+	size_t first, last, start;
+
+	/* the bytes of the tile's rows, widened to whole pages */
+	first = (t->y0 * c->h->pitch + t->x0) * sizeof(int);
+	last = ((t->y0 + t->h - 1) * c->h->pitch + t->x0 + t->w) * sizeof(int);
+	start = first / c->page * c->page;
+	if (msync((char *)frame + start, last - start, MS_SYNC) < 0) {
+		/* not on disk: leave it to be computed again */
+		perror("checkpoint: msync");
+		return;
+	}
+	__atomic_fetch_or(&c->bitmap[unit / 64], 1ULL << (unit % 64), __ATOMIC_RELEASE);
+}
+
+int checkpoint_count(const struct checkpoint *c)
+{
+	int i, n = 0;
+
+	for (i = 0; i < (int)c->h->ntiles; i++)
+		n += checkpoint_done(c, i);
+	return n;
+}
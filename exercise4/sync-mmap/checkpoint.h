@@ -0,0 +1,50 @@
+/*
+ * checkpoint.h
+ *
+ * Checkpoints of long renders: the frame itself lives in an mmap'ed
+ * file, next to the view it is of and a bitmap of the units already
+ * computed, so that a render interrupted (or crashed) half way can be
+ * started again and only compute the units it had not finished.
+ *
+ */
+
+#ifndef CHECKPOINT_H__
+#define CHECKPOINT_H__
+
+#include "frame.h"
+#include "tile.h"
+
+struct checkpoint;
+
+/*
+ * Open the checkpoint in path for a render of vp split into grid, of
+ * iteration counts rather than colors if iterations is set, creating
+ * it if there is none, and make frame the frame stored in it:
+ * MAP_SHARED, so forked workers can fill it, and owned by the
+ * checkpoint (do not frame_free() it). Returns NULL on error, or if
+ * path is a checkpoint of another view, grid or kind of values, or not
+ * a checkpoint at all: only an empty file, or one whose header a crash
+ * left unfinished, is (re)initialized.
+ */
+struct checkpoint *checkpoint_open(const char *path, const struct viewport *vp,
+				   const struct tile_grid *grid, int iterations,
+				   struct frame *frame);
+
+/* Flush the completion bitmap and unmap the file, frame included */
+void checkpoint_close(struct checkpoint *c);
+
+/* Whether unit is in the checkpoint already */
+int checkpoint_done(const struct checkpoint *c, int unit);
+
+/*
+ * Record unit, whose pixels (tile t) are in the frame, as done. The
+ * pixels are written to the file before its bit is set, so a bit that
+ * reached the disk always stands for pixels that did. May be called by
+ * any number of workers at once.
+ */
+void checkpoint_commit(struct checkpoint *c, int unit, const struct tile *t);
+
+/* Units done so far */
+int checkpoint_count(const struct checkpoint *c);
+
+#endif /* CHECKPOINT_H__ */
@@ -0,0 +1,200 @@
+/*
+ * equalize.c
+ *
+ * Four phases, each split between the threads and ended by a barrier:
+ *
+ *  1. every thread builds a histogram of its band of rows, in memory
+ *     of its own, so counting takes no atomics and shares no lines;
+ *  2. every thread sums one range of counts over all histograms, and
+ *     the escaped pixels of its range;
+ *  3. thread 0 turns those per-range totals into each range's offset
+ *     (a scan of nthreads numbers), and every thread then runs the
+ *     prefix sum of its own range from its offset, making the color
+ *     of each count on the way;
+ *  4. every thread maps its band of rows through the colors.
+ *
+ * Phases 1 and 4 are linear in the pixels, 2 and 3 in the counts
+ * times the threads, so at large frames all of it scales with cores.
+ *
+ * The barriers need every thread, so none starts until all of them
+ * are up; if one cannot be started, the others are sent home.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "equalize.h"
+#include "tile.h"
+#include "tune.h"
+
+struct eq;
+
+struct eq_thread {
+	struct eq *e;
+	pthread_t tid;
+	int id;
+	unsigned int *hist;	/* of its rows */
+	unsigned long part;	/* escaped pixels in its range of counts */
+	unsigned long offset;	/* escaped pixels in the ranges before it */
+};
+
+struct eq {
+	const struct frame *src;
+	struct frame *dst;
+	int max_iter;
+	int nthreads;
+	struct eq_thread *t;
+	unsigned long *total;	/* pixels of each count */
+	int *color;		/* of each count */
+	unsigned long escaped;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int gate;		/* 0 until all start, then 1, or -1 to quit */
+	pthread_barrier_t barrier;
+	double stamp[5];	/* start and the end of each phase */
+};
+
+/* The end of phase n: wait for everyone, and note the time once */
+static void phase_end(struct eq *e, int id, int n)
+{
+	pthread_barrier_wait(&e->barrier);
+	if (id == 0)
+		e->stamp[n] = tune_now();
+}
+
+static void *eq_thread(void *arg)
+{
+	struct eq_thread *me = arg;
+	struct eq *e = me->e;
+	int n = e->nthreads, bins = e->max_iter + 1, width = e->src->width;
+	int r0 = (long)e->src->height * me->id / n, r1 = (long)e->src->height * (me->id + 1) / n;
+	int c0 = (long)bins * me->id / n, c1 = (long)bins * (me->id + 1) / n;
+	unsigned long sum, below;
+	const int *s;
+	int *d;
+	int r, x, c, i, v, gate;
+
+	pthread_mutex_lock(&e->mutex);
+	while ((gate = e->gate) == 0)
+		pthread_cond_wait(&e->cond, &e->mutex);
+	pthread_mutex_unlock(&e->mutex);
+	if (gate < 0)
+		return NULL;
+
+	for (r = r0; r < r1; r++) {
+		s = frame_row(e->src, r);
+		for (x = 0; x < width; x++) {
+			v = s[x];
+			me->hist[v < 0 ? 0 : v > e->max_iter ? e->max_iter : v]++;
+		}
+	}
+	phase_end(e, me->id, 1);
+
+	for (sum = 0, c = c0; c < c1; c++) {
+		e->total[c] = 0;
+		for (i = 0; i < n; i++)
+			e->total[c] += e->t[i].hist[c];
+		if (c < e->max_iter)
+			sum += e->total[c];
+	}
+	me->part = sum;
+	phase_end(e, me->id, 2);
+
+	if (me->id == 0) {
+		for (sum = 0, i = 0; i < n; i++) {
+			e->t[i].offset = sum;
+			sum += e->t[i].part;
+		}
+		e->escaped = sum;
+	}
+	pthread_barrier_wait(&e->barrier);
+	for (below = me->offset, c = c0; c < c1; c++) {
+		/* with nothing escaped, there is only the inside to color */
+		if (c == e->max_iter || e->escaped == 0) {
+			e->color[c] = mandel_palette(255);
+			continue;
+		}
+		/* below < escaped: the entries up to 254, 255 is for the inside */
+		e->color[c] = mandel_palette(below * 255 / e->escaped);
+		below += e->total[c];
+	}
+	phase_end(e, me->id, 3);
+
+	for (r = r0; r < r1; r++) {
+		s = frame_row(e->src, r);
+		d = frame_row(e->dst, r);
+		for (x = 0; x < width; x++) {
+			v = s[x];
+			d[x] = e->color[v < 0 ? 0 : v > e->max_iter ? e->max_iter : v];
+		}
+	}
+	phase_end(e, me->id, 4);
+	return NULL;
+}
+
+int equalize_frame(const struct frame *src, struct frame *dst, int max_iter,
+		   int nthreads, struct equalize_stats *st)
+{
+	struct eq e = { .src = src, .dst = dst, .max_iter = max_iter, .nthreads = nthreads };
+	int i, n, ret = 0;
+
+	e.t = calloc(nthreads, sizeof(*e.t));
+	e.total = malloc((max_iter + 1) * sizeof(*e.total));
+	e.color = malloc((max_iter + 1) * sizeof(*e.color));
+	if (e.t == NULL || e.total == NULL || e.color == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < nthreads; i++) {
+		e.t[i].e = &e;
+		e.t[i].id = i;
+		e.t[i].hist = calloc(max_iter + 1, sizeof(*e.t[i].hist));
+		if (e.t[i].hist == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+	pthread_barrier_init(&e.barrier, NULL, nthreads);
+	pthread_mutex_init(&e.mutex, NULL);
+	pthread_cond_init(&e.cond, NULL);
+
+	e.stamp[0] = tune_now();
+	for (n = 0; n < nthreads; n++) {
+		ret = pthread_create(&e.t[n].tid, NULL, eq_thread, &e.t[n]);
+		if (ret) {
+			errno = ret;
+			perror("pthread_create");
+			break;
+		}
+	}
+	pthread_mutex_lock(&e.mutex);
+	e.gate = ret ? -1 : 1;
+	pthread_cond_broadcast(&e.cond);
+	pthread_mutex_unlock(&e.mutex);
+	for (i = 0; i < n; i++)
+		pthread_join(e.t[i].tid, NULL);
+
+	if (st && ret == 0) {
+		st->histogram = e.stamp[1] - e.stamp[0];
+		st->merge = e.stamp[2] - e.stamp[1];
+		st->scan = e.stamp[3] - e.stamp[2];
+		st->map = e.stamp[4] - e.stamp[3];
+	}
+	pthread_cond_destroy(&e.cond);
+	pthread_mutex_destroy(&e.mutex);
+	pthread_barrier_destroy(&e.barrier);
+	for (i = 0; i < nthreads; i++)
+		free(e.t[i].hist);
+	free(e.color);
+	free(e.total);
+	free(e.t);
+	if (ret) {
+		errno = ret;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,37 @@
+/*
+ * equalize.h
+ *
+ * Histogram-equalized coloring. Clamping iteration counts to 255 and
+ * taking palette entry count spends most of the palette on counts a
+ * deep view has none of; equalizing gives every palette entry about
+ * as many escaped pixels, whatever counts they happen to have.
+ *
+ */
+
+#ifndef EQUALIZE_H__
+#define EQUALIZE_H__
+
+#include "frame.h"
+
+/* Seconds spent in each phase of the last equalize_frame() */
+struct equalize_stats {
+	double histogram;	/* per-thread histograms of their rows */
+	double merge;		/* the histograms summed, by ranges of counts */
+	double scan;		/* prefix sums of the ranges, then of each range */
+	double map;		/* counts to colors */
+};
+
+/*
+ * Color src, a frame of iteration counts from 0 to max_iter as
+ * compute_mandel_tile_iterations() leaves them, into dst (which may be
+ * src): pixels that escaped after n iterations get the palette entry
+ * of the fraction of escaped pixels that escaped sooner, pixels that
+ * did not escape palette entry 255, as does every pixel of a view
+ * where none escaped. Every phase is split between nthreads threads.
+ * Returns 0 on success, -1 with errno set if the threads could not be
+ * started (dst is left as it was then); exits on out of memory.
+ */
+int equalize_frame(const struct frame *src, struct frame *dst, int max_iter,
+		   int nthreads, struct equalize_stats *st);
+
+#endif /* EQUALIZE_H__ */
@@ -0,0 +1,383 @@
+/*
+ * farm.c
+ *
+ * Render farm: addresses, the wire protocol and the worker side.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <netdb.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "farm.h"
+
+#define ADDRLEN		256
+
+/*************
+ * Addresses *
+ *************/
+
+/*
+ * Resolve addr into a socket, then connect or bind + listen it.
+ */
+static int farm_socket(const char *addr, int server)
+{
+	struct sockaddr_un sun;
+	struct addrinfo hints, *res, *ai;
+	char host[ADDRLEN], *port;
+	int fd, one = 1, ret;
+
+	if (strncmp(addr, "unix:", 5) == 0) {
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		if (strlen(addr + 5) >= sizeof(sun.sun_path)) {
+			fprintf(stderr, "farm: path too long: %s\n", addr + 5);
+			return -1;
+		}
+		strcpy(sun.sun_path, addr + 5);
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+			perror("socket");
+			return -1;
+		}
+		if (server) {
+			unlink(sun.sun_path);
+			ret = bind(fd, (struct sockaddr *)&sun, sizeof(sun));
+			if (ret == 0)
+				ret = listen(fd, SOMAXCONN);
+		} else {
+			ret = connect(fd, (struct sockaddr *)&sun, sizeof(sun));
+		}
+		if (ret < 0) {
+			perror(addr);
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	snprintf(host, sizeof(host), "%s", addr);
+	port = strrchr(host, ':');
+	if (port == NULL) {
+		fprintf(stderr, "farm: `%s' is neither unix:path nor host:port\n", addr);
+		return -1;
+	}
+	*port++ = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = server ? AI_PASSIVE : 0;
+	ret = getaddrinfo(*host ? host : NULL, port, &hints, &res);
+	if (ret) {
+		fprintf(stderr, "farm: %s: %s\n", addr, gai_strerror(ret));
+		return -1;
+	}
+	fd = -1;
+	for (ai = res; ai; ai = ai->ai_next) {
+		if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+			continue;
+		if (server) {
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+			    listen(fd, SOMAXCONN) == 0)
+				break;
+		} else if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			/* requests are small and latency bound */
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+		fprintf(stderr, "farm: cannot %s %s: %s\n", server ? "listen at" : "connect to",
+			addr, strerror(errno));
+	freeaddrinfo(res);
+	return fd;
+}
+
+int farm_connect(const char *addr)
+{
+	return farm_socket(addr, 0);
+}
+
+int farm_listen(const char *addr)
+{
+	return farm_socket(addr, 1);
+}
+
+/************
+ * Protocol *
+ ************/
+
+static unsigned char *put32(unsigned char *p, uint32_t v)
+{
+	v = htobe32(v);
+	memcpy(p, &v, 4);
+	return p + 4;
+}
+
+static unsigned char *put64(unsigned char *p, double d)
+{
+	uint64_t v;
+
+	memcpy(&v, &d, 8);
+	v = htobe64(v);
+	memcpy(p, &v, 8);
+	return p + 8;
+}
+
+static const unsigned char *get32(const unsigned char *p, uint32_t *v)
+{
+	memcpy(v, p, 4);
+	*v = be32toh(*v);
+	return p + 4;
+}
+
+static const unsigned char *get64(const unsigned char *p, double *d)
+{
+	uint64_t v;
+
+	memcpy(&v, p, 8);
+	v = be64toh(v);
+	memcpy(d, &v, 8);
+	return p + 8;
+}
+
+void farm_pack_req(const struct farm_req *req, unsigned char *buf)
+{
+	buf = put32(buf, FARM_REQ_MAGIC);
+	buf = put32(buf, req->unit);
+	buf = put64(buf, req->vp.xmin);
+	buf = put64(buf, req->vp.ymax);
+	buf = put64(buf, req->vp.xstep);
+	buf = put64(buf, req->vp.ystep);
+	buf = put32(buf, req->vp.max_iter);
+	buf = put32(buf, req->t.x0);
+	buf = put32(buf, req->t.y0);
+	buf = put32(buf, req->t.w);
+	put32(buf, req->t.h);
+}
+
+void farm_unpack_req(const unsigned char *buf, struct farm_req *req)
+{
+	uint32_t magic, v[5];
+
+	buf = get32(buf, &magic);
+	buf = get32(buf, &req->unit);
+	buf = get64(buf, &req->vp.xmin);
+	buf = get64(buf, &req->vp.ymax);
+	buf = get64(buf, &req->vp.xstep);
+	buf = get64(buf, &req->vp.ystep);
+	buf = get32(buf, &v[0]);
+	buf = get32(buf, &v[1]);
+	buf = get32(buf, &v[2]);
+	buf = get32(buf, &v[3]);
+	get32(buf, &v[4]);
+	memset(&req->t, 0, sizeof(req->t));
+	req->vp.max_iter = v[0];
+	req->t.x0 = v[1];
+	req->t.y0 = v[2];
+	req->t.w = v[3];
+	req->t.h = v[4];
+}
+
+static unsigned char *put_varint(unsigned char *p, uint32_t v)
+{
+	for (; v >= 0x80; v >>= 7)
+		*p++ = v | 0x80;
+	*p++ = v;
+	return p;
+}
+
+/* NULL if the varint runs past end or does not fit in 32 bits */
+static const unsigned char *get_varint(const unsigned char *p, const unsigned char *end,
+				       uint32_t *v)
+{
+	int shift;
+
+	*v = 0;
+	for (shift = 0; p < end && shift < 35; shift += 7) {
+		if (shift == 28 && *p > 0x0f)
+			return NULL;
+		*v |= (uint32_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80))
+			return p;
+	}
+	return NULL;
+}
+
+size_t farm_encode(const int *src, size_t pitch, int w, int h, unsigned char *dst)
+{
+	unsigned char *p = dst;
+	int i, j, run, prev = 0, d;
+
+	for (j = 0; j < h; j++, src += pitch) {
+		for (i = 0; i < w; i += run) {
+			for (run = 1; i + run < w && src[i + run] == src[i]; run++)
+				;
+			d = src[i] - prev;
+			p = put_varint(p, d < 0 ? 2 * (uint32_t)-d - 1 : 2 * (uint32_t)d);
+			p = put_varint(p, run);
+			prev = src[i];
+		}
+	}
+	return p - dst;
+}
+
+int farm_decode(const unsigned char *src, size_t len, int *dst, size_t pitch, int w, int h,
+		int max_iter)
+{
+	const unsigned char *end = src + len;
+	uint32_t z, run;
+	long val = 0;
+	int i, j;
+
+	for (j = 0; j < h; j++, dst += pitch) {
+		for (i = 0; i < w; ) {
+			if ((src = get_varint(src, end, &z)) == NULL ||
+			    (src = get_varint(src, end, &run)) == NULL)
+				return -1;
+			val += z & 1 ? -(long)(z >> 1) - 1 : (long)(z >> 1);
+			if (val < 0 || val > max_iter || run == 0 || run > (uint32_t)(w - i))
+				return -1;
+			while (run--)
+				dst[i++] = val;
+		}
+	}
+	return src == end ? 0 : -1;
+}
+
+int farm_read(int fd, void *buf, size_t n)
+{
+	ssize_t ret;
+
+	while (n > 0) {
+		ret = read(fd, buf, n);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		buf = (char *)buf + ret;
+		n -= ret;
+	}
+	return 0;
+}
+
+int farm_write(int fd, const void *buf, size_t n)
+{
+	ssize_t ret;
+
+	while (n > 0) {
+		/* a peer that went away is an error, not a SIGPIPE */
+		ret = send(fd, buf, n, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		buf = (const char *)buf + ret;
+		n -= ret;
+	}
+	return 0;
+}
+
+/**********
+ * Worker *
+ **********/
+
+/*
+ * Serve one coordinator until it hangs up: compute the iteration counts
+ * of every requested tile into a scratch buffer and send them back
+ * encoded.
+ */
+static void farm_session(int fd)
+{
+	unsigned char req_buf[FARM_REQ_SIZE], *out = NULL, *p;
+	struct farm_req req;
+	uint32_t magic;
+	size_t len, cap = 0;
+	int *pixels = NULL;
+
+	while (farm_read(fd, req_buf, sizeof(req_buf)) == 0) {
+		get32(req_buf, &magic);
+		if (magic != FARM_REQ_MAGIC) {
+			fprintf(stderr, "farm: bad request\n");
+			break;
+		}
+		farm_unpack_req(req_buf, &req);
+		if (req.t.w <= 0 || req.t.h <= 0 || req.t.w > 65536 || req.t.h > 65536) {
+			fprintf(stderr, "farm: bad tile %dx%d\n", req.t.w, req.t.h);
+			break;
+		}
+		if ((size_t)req.t.w * req.t.h > cap) {
+			cap = (size_t)req.t.w * req.t.h;
+			free(pixels);
+			free(out);
+			pixels = malloc(cap * sizeof(*pixels));
+			out = malloc(FARM_REP_SIZE + FARM_ENC_MAX(cap));
+			if (pixels == NULL || out == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				exit(1);
+			}
+		}
+
+		compute_mandel_tile_iterations(&req.vp, &req.t, pixels, req.t.w);
+		len = farm_encode(pixels, req.t.w, req.t.w, req.t.h, out + FARM_REP_SIZE);
+
+		/* header and pixels in one segment, no Nagle delay in between */
+		p = put32(out, FARM_REP_MAGIC);
+		p = put32(p, req.unit);
+		put32(p, len);
+		if (farm_write(fd, out, FARM_REP_SIZE + len) < 0)
+			break;
+	}
+	free(pixels);
+	free(out);
+}
+
+int farm_serve(const char *addr)
+{
+	int lfd, fd;
+	pid_t pid;
+
+	if ((lfd = farm_listen(addr)) < 0)
+		return -1;
+	/* sessions are children nobody waits for */
+	signal(SIGCHLD, SIG_IGN);
+	fprintf(stderr, "farm: worker listening at %s\n", addr);
+
+	for (;;) {
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			return -1;
+		}
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			close(fd);
+			continue;
+		}
+		if (pid == 0) {
+			close(lfd);
+			farm_session(fd);
+			close(fd);
+			exit(0);
+		}
+		close(fd);
+	}
+}
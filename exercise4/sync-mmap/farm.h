@@ -0,0 +1,81 @@
+/*
+ * farm.h
+ *
+ * A render farm over sockets: worker processes (`mandel -L address')
+ * compute tiles on request, and the `farm' backend hands them the
+ * tiles of a frame and reassembles the results.
+ *
+ * Addresses are `unix:/path' for Unix-domain sockets or `host:port'
+ * for TCP.
+ *
+ */
+
+#ifndef FARM_H__
+#define FARM_H__
+
+#include <stdint.h>
+
+#include "render.h"
+
+/* Tiles in flight per worker at most */
+#define FARM_WINDOW		4
+/* A worker that owes us tiles and is silent for this long is gone */
+#define FARM_TIMEOUT_MS		10000
+
+/*
+ * Wire format, all integers in network byte order, doubles sent as
+ * their IEEE 754 bits:
+ *
+ *   request: magic, unit, xmin, ymax, xstep, ystep, max_iter, x0, y0, w, h
+ *   reply:   magic, unit, len, then len bytes of the tile's iteration
+ *            counts, row by row in runs of equal counts: the change
+ *            from the count of the run before (zigzag encoded), then
+ *            the length of the run, both as LEB128 varints
+ *
+ * Workers send counts rather than colors, and the coordinator colors
+ * them (or keeps them, for -e): runs are as long as for colors inside
+ * the set and in its bands, and the small steps between neighbours
+ * mostly take one byte.
+ */
+#define FARM_REQ_MAGIC		0x4d525132	/* "MRQ2" */
+#define FARM_REP_MAGIC		0x4d525032	/* "MRP2" */
+#define FARM_REQ_SIZE		(2 * 4 + 4 * 8 + 5 * 4)
+#define FARM_REP_SIZE		(3 * 4)
+/* Longest encoding of n pixels: two 5-byte varints each */
+#define FARM_ENC_MAX(n)		(10 * (size_t)(n))
+
+struct farm_req {
+	uint32_t unit;
+	struct viewport vp;
+	struct tile t;		/* only x0, y0, w and h travel */
+};
+
+/* Connect to / listen at an address; return a socket, -1 on error */
+int farm_connect(const char *addr);
+int farm_listen(const char *addr);
+
+/* Encode / decode a request into FARM_REQ_SIZE bytes */
+void farm_pack_req(const struct farm_req *req, unsigned char *buf);
+void farm_unpack_req(const unsigned char *buf, struct farm_req *req);
+
+/*
+ * Encode the w x h iteration counts at src (with the given pitch) into
+ * dst, which must hold FARM_ENC_MAX(w * h) bytes; returns the encoded
+ * length. Decoding returns -1 if the data does not fill the tile
+ * exactly, or holds counts outside 0..max_iter.
+ */
+size_t farm_encode(const int *src, size_t pitch, int w, int h, unsigned char *dst);
+int farm_decode(const unsigned char *src, size_t len, int *dst, size_t pitch, int w, int h,
+		int max_iter);
+
+/* Read / write exactly n bytes; -1 on error or end of file */
+int farm_read(int fd, void *buf, size_t n);
+int farm_write(int fd, const void *buf, size_t n);
+
+/*
+ * Worker mode: serve tile requests of coordinators connecting to addr,
+ * one process per connection. Returns only on error.
+ */
+int farm_serve(const char *addr);
+
+#endif /* FARM_H__ */
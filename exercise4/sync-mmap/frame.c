@@ -0,0 +1,269 @@
+/*
+ * frame.c
+ *
+ * Frame buffers: one contiguous mapping per frame, with every row
+ * starting on its own cache line, optionally backed by huge pages.
+ *
+ * A single mapping means a single VMA however large the frame is,
+ * and with huge pages far fewer page faults and TLB misses than
+ * one page-rounded mapping per row.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frame.h"
+#include "workq.h"
+
+#define CACHE_LINE_DEFAULT	64
+#define HUGE_PAGE_DEFAULT	(2UL << 20)
+#define MEMINFO_PATH		"/proc/meminfo"
+
+static size_t cache_line_size(void)
+{
+	long n = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+
+	return n > 0 ? n : CACHE_LINE_DEFAULT;
+}
+
+/* The default huge page size, from the Hugepagesize line of /proc/meminfo */
+static size_t huge_page_size(void)
+{
+	char line[128];
+	unsigned long kb;
+	size_t size = HUGE_PAGE_DEFAULT;
+	FILE *f;
+
+	f = fopen(MEMINFO_PATH, "r");
+	if (!f)
+		return size;
+	while (fgets(line, sizeof(line), f) != NULL)
+		if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+			size = kb << 10;
+			break;
+		}
+	fclose(f);
+	return size;
+}
+
+static size_t round_up(size_t n, size_t to)
+{
+	return (n + to - 1) / to * to;
+}
+
+int *frame_row(const struct frame *frame, int row)
+{
+	return frame->base + row * frame->pitch;
+}
+
+void frame_alloc(struct frame *frame, int width, int height, int flags)
+{
+	int mflags = MAP_ANONYMOUS | (flags & FRAME_SHARED ? MAP_SHARED : MAP_PRIVATE) |
+		     (flags & FRAME_NORESERVE ? MAP_NORESERVE : 0);
+	size_t bytes;
+	void *addr = MAP_FAILED;
+
+	frame->width = width;
+	frame->height = height;
+	frame->pitch = round_up(width * sizeof(int), cache_line_size()) / sizeof(int);
+	frame->flags = flags;
+	frame->pub = NULL;
+	bytes = frame->pitch * height * sizeof(int);
+
+#ifdef MAP_HUGETLB
+	if (flags & FRAME_HUGETLB) {
+		frame->mapped = round_up(bytes, huge_page_size());
+		addr = mmap(NULL, frame->mapped, PROT_READ | PROT_WRITE,
+			    mflags | MAP_HUGETLB, -1, 0);
+		if (addr == MAP_FAILED) {
+			/* usually no huge pages reserved in vm.nr_hugepages */
+			perror("frame_alloc: mmap(MAP_HUGETLB), using transparent huge pages");
+			frame->flags = (flags & ~FRAME_HUGETLB) | FRAME_THP;
+		}
+	}
+#endif
+	if (addr == MAP_FAILED) {
+		frame->mapped = round_up(bytes, sysconf(_SC_PAGE_SIZE));
+		addr = mmap(NULL, frame->mapped, PROT_READ | PROT_WRITE, mflags, -1, 0);
+		if (addr == MAP_FAILED) {
+			perror("frame_alloc: mmap");
+			exit(1);
+		}
+	}
+#ifdef MADV_HUGEPAGE
+	if ((frame->flags & FRAME_THP) && madvise(addr, frame->mapped, MADV_HUGEPAGE) < 0)
+		perror("frame_alloc: madvise(MADV_HUGEPAGE)");
+#endif
+
+	frame->base = addr;
+}
+
+void frame_free(struct frame *frame)
+{
+	void *addr = frame->pub ? (void *)frame->pub : (void *)frame->base;
+
+	if (munmap(addr, frame->mapped) < 0) {
+		perror("frame_free: munmap");
+		exit(1);
+	}
+	if (frame->pub) {
+		close(frame->pub_fd);
+		if (frame->pub_name[0])
+			shm_unlink(frame->pub_name);
+		frame->pub = NULL;
+	}
+	frame->base = NULL;
+}
+
+/********************
+ * Published frames *
+ ********************/
+
+void frame_publish(struct frame *frame, int width, int height, int flags, const char *name)
+{
+	struct frame_header *h;
+	size_t hdr, bytes;
+	int fd;
+
+	frame->width = width;
+	frame->height = height;
+	frame->pitch = round_up(width * sizeof(int), cache_line_size()) / sizeof(int);
+	/* huge pages are not supported for these; MFD_HUGETLB is a separate pool */
+	frame->flags = (flags & ~(FRAME_HUGETLB | FRAME_THP)) | FRAME_SHARED;
+	frame->pub_name[0] = '\0';
+
+	/* the rows start page aligned, as they would in a private frame */
+	hdr = round_up(sizeof(*h) + (height + 63) / 64 * sizeof(uint64_t), sysconf(_SC_PAGE_SIZE));
+	bytes = frame->pitch * height * sizeof(int);
+	frame->mapped = hdr + round_up(bytes, sysconf(_SC_PAGE_SIZE));
+
+	if (strcmp(name, "memfd") == 0) {
+		fd = memfd_create("mandel-frame", MFD_CLOEXEC);
+	} else {
+		snprintf(frame->pub_name, sizeof(frame->pub_name), "%s", name);
+		fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	}
+	if (fd < 0 || ftruncate(fd, frame->mapped) < 0) {
+		perror(name);
+		exit(1);
+	}
+	h = mmap(NULL, frame->mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (h == MAP_FAILED) {
+		perror("frame_publish: mmap");
+		exit(1);
+	}
+
+	h->width = width;
+	h->height = height;
+	h->pitch = frame->pitch;
+	h->data = hdr;
+	__atomic_store_n(&h->magic, FRAME_MAGIC, __ATOMIC_RELEASE);
+
+	frame->pub = h;
+	frame->pub_fd = fd;
+	frame->base = (int *)((char *)h + hdr);
+	if (frame->pub_name[0] == '\0')
+		fprintf(stderr, "frame published at /proc/%d/fd/%d\n", getpid(), fd);
+}
+
+void frame_begin(struct frame *frame)
+{
+	struct frame_header *h = frame->pub;
+
+	if (h == NULL)
+		return;
+	/* odd: being drawn, and the ready bits are reset for it */
+	__atomic_fetch_add(&h->seq, 1, __ATOMIC_SEQ_CST);
+	memset(h->ready, 0, (frame->height + 63) / 64 * sizeof(uint64_t));
+	h->partial = 0;
+	__atomic_store_n(&h->rows, 0, __ATOMIC_SEQ_CST);
+	futex_wake(&h->rows, INT_MAX);
+}
+
+void frame_rows_ready(struct frame *frame, int row, int n)
+{
+	struct frame_header *h = frame->pub;
+	int r;
+
+	if (h == NULL)
+		return;
+	for (r = row; r < row + n; r++)
+		__atomic_fetch_or(&h->ready[r / 64], 1ULL << (r % 64), __ATOMIC_RELEASE);
+	__atomic_fetch_add(&h->rows, n, __ATOMIC_SEQ_CST);
+	futex_wake(&h->rows, INT_MAX);
+}
+
+void frame_end(struct frame *frame)
+{
+	struct frame_header *h = frame->pub;
+
+	if (h == NULL)
+		return;
+	__atomic_fetch_add(&h->seq, 1, __ATOMIC_SEQ_CST);
+	futex_wake(&h->rows, INT_MAX);
+}
+
+void frame_mark_partial(struct frame *frame, unsigned int n)
+{
+	if (frame->pub)
+		__atomic_store_n(&frame->pub->partial, n, __ATOMIC_SEQ_CST);
+}
+
+struct frame_header *frame_attach(const char *path, size_t *len)
+{
+	struct frame_header *h;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*h)) {
+		fprintf(stderr, "%s: not a published frame\n", path);
+		close(fd);
+		return NULL;
+	}
+	h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (h == MAP_FAILED) {
+		perror("frame_attach: mmap");
+		return NULL;
+	}
+	/* rows past the ready bits, and the object as big as they say */
+	if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != FRAME_MAGIC ||
+	    h->pitch < h->width || h->pitch == 0 ||
+	    h->data < offsetof(struct frame_header, ready) +
+		      ((uint64_t)h->height + 63) / 64 * sizeof(uint64_t) ||
+	    h->data > (uint64_t)st.st_size ||
+	    ((uint64_t)st.st_size - h->data) / sizeof(int) / h->pitch < h->height) {
+		fprintf(stderr, "%s: not a published frame\n", path);
+		munmap(h, st.st_size);
+		return NULL;
+	}
+	*len = st.st_size;
+	return h;
+}
+
+int frame_parse_pages(const char *s, int *flags)
+{
+	*flags &= ~(FRAME_HUGETLB | FRAME_THP);
+	if (strcmp(s, "thp") == 0)
+		*flags |= FRAME_THP;
+	else if (strcmp(s, "hugetlb") == 0)
+		*flags |= FRAME_HUGETLB;
+	else if (strcmp(s, "none") != 0)
+		return -1;
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * frame.h
+ *
+ * Frame buffers: one contiguous mapping per frame, with every row
+ * starting on its own cache line, optionally backed by huge pages.
+ *
+ */
+
+#ifndef FRAME_H__
+#define FRAME_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* frame_alloc() flags */
+#define FRAME_SHARED	0x1	/* MAP_SHARED, so forked children can fill it */
+#define FRAME_HUGETLB	0x2	/* MAP_HUGETLB, falling back to FRAME_THP */
+#define FRAME_THP	0x4	/* madvise(MADV_HUGEPAGE) */
+#define FRAME_NORESERVE	0x8	/* MAP_NORESERVE, for frames far larger than memory */
+
+/*
+ * A published frame lives in a memfd or POSIX shared memory object
+ * behind this header, so that a viewer or encoder can mmap it and take
+ * rows as they are done. All fields are in host byte order.
+ *
+ * seq is odd while a frame is being drawn and even once it is
+ * complete. The ready bits belong to the frame being drawn (or last
+ * drawn); `rows' counts them and can be waited on with FUTEX_WAIT.
+ * Pixels of a row are written before its bit is set.
+ */
+#define FRAME_MAGIC	0x3142464d	/* "MFB1" */
+
+struct frame_header {
+	uint32_t magic;
+	uint32_t seq;
+	uint32_t rows;		/* rows ready in this frame */
+	uint32_t width, height;
+	uint32_t pitch;		/* in ints */
+	uint32_t partial;	/* tiles of this frame approximated, see render.h */
+	uint64_t data;		/* offset of row 0 from the header */
+	uint64_t ready[];	/* bit r % 64 of word r / 64: row r is done */
+};
+
+/*
+ * A frame of xterm color values. Row r starts at base + r * pitch;
+ * pitch is rounded up to a whole number of cache lines, so workers
+ * writing adjacent rows never write to the same cache line.
+ */
+struct frame {
+	int *base;
+	size_t pitch;		/* in ints */
+	int width, height;
+	int flags;
+	size_t mapped;		/* length of the mapping, in bytes */
+	struct frame_header *pub;	/* start of the mapping if published */
+	int pub_fd;
+	char pub_name[64];	/* the shm object to unlink, if any */
+};
+
+int *frame_row(const struct frame *frame, int row);
+
+/* Exits on failure, like create_shared_memory_area() */
+void frame_alloc(struct frame *frame, int width, int height, int flags);
+void frame_free(struct frame *frame);
+
+/*
+ * Allocate a frame published under name: `memfd' for an anonymous
+ * memfd (its /proc/<pid>/fd path is printed on stderr), or `/name'
+ * for a POSIX shared memory object (/dev/shm/name), removed again by
+ * frame_free(). The frame is MAP_SHARED. Exits on failure.
+ */
+void frame_publish(struct frame *frame, int width, int height, int flags, const char *name);
+
+/*
+ * Mark the start of a new frame, rows [row, row + n) as done, and the
+ * end of the frame. No-ops for frames that are not published.
+ */
+void frame_begin(struct frame *frame);
+void frame_rows_ready(struct frame *frame, int row, int n);
+void frame_end(struct frame *frame);
+
+/* Record that n tiles of the frame being drawn are approximations */
+void frame_mark_partial(struct frame *frame, unsigned int n);
+
+/* Map a published frame read-only; returns NULL on error */
+struct frame_header *frame_attach(const char *path, size_t *len);
+
+/* Parse a -m argument: none, thp or hugetlb. Returns -1 if invalid. */
+int frame_parse_pages(const char *s, int *flags);
+
+#endif /* FRAME_H__ */
@@ -0,0 +1,179 @@
+/*
+ * layout.c
+ *
+ * A Morton layout of bx x by blocks has a slot for every block of a
+ * 2^a x 2^b grid, 2^a >= bx, 2^b >= by: the low min(a, b) bits of the
+ * block coordinates are interleaved, and the remaining bits of the
+ * longer side go on top. A frame far wider than high thus becomes a
+ * row of Z-ordered squares, and never more than 4 times the slots it
+ * needs.
+ *
+ */
+
+#include <string.h>
+
+#include "layout.h"
+
+#define MAX_BLOCKS	(1 << 16)	/* per side, what layout_spread() takes */
+
+static int log2_ceil(unsigned int n)
+{
+	int k = 0;
+
+	while ((1U << k) < n)
+		k++;
+	return k;
+}
+
+int layout_init(struct layout *l, enum layout_kind kind, int width, int height, int block)
+{
+	int a, b;
+
+	memset(l, 0, sizeof(*l));
+	l->kind = kind;
+	l->width = width;
+	l->height = height;
+	if (kind == LAYOUT_ROWS) {
+		l->pitch = width;
+		l->nblocks = height;
+		l->size = (size_t)width * height;
+		return 0;
+	}
+
+	if (block <= 0 || (block & (block - 1)))
+		return -1;
+	l->shift = log2_ceil(block);
+	l->blocks_x = (width + block - 1) >> l->shift;
+	l->blocks_y = (height + block - 1) >> l->shift;
+	if (l->blocks_x > MAX_BLOCKS || l->blocks_y > MAX_BLOCKS)
+		return -1;
+	if (kind == LAYOUT_MORTON) {
+		a = log2_ceil(l->blocks_x);
+		b = log2_ceil(l->blocks_y);
+		l->zbits = a < b ? a : b;
+		l->ztall = b > a;
+		l->nblocks = (size_t)1 << (a + b);
+	} else {
+		l->nblocks = (size_t)l->blocks_x * l->blocks_y;
+	}
+	l->size = l->nblocks << 2 * l->shift;
+	return 0;
+}
+
+int layout_parse(const char *s, enum layout_kind *kind)
+{
+	if (strcmp(s, "rows") == 0)
+		*kind = LAYOUT_ROWS;
+	else if (strcmp(s, "blocked") == 0)
+		*kind = LAYOUT_BLOCKED;
+	else if (strcmp(s, "morton") == 0)
+		*kind = LAYOUT_MORTON;
+	else
+		return -1;
+	return 0;
+}
+
+const char *layout_name(enum layout_kind kind)
+{
+	static const char *names[] = { "rows", "blocked", "morton" };
+
+	return names[kind];
+}
+
+/* The inverse of layout_spread(): gather the even bits */
+static uint32_t compact(uint32_t v)
+{
+	v &= 0x55555555;
+	v = (v | v >> 1) & 0x33333333;
+	v = (v | v >> 2) & 0x0f0f0f0f;
+	v = (v | v >> 4) & 0x00ff00ff;
+	v = (v | v >> 8) & 0x0000ffff;
+	return v;
+}
+
+int layout_block(const struct layout *l, size_t n, struct tile *t)
+{
+	int size = 1 << l->shift;
+	uint32_t low;
+
+	switch (l->kind) {
+	case LAYOUT_BLOCKED:
+		t->tx = n % l->blocks_x;
+		t->ty = n / l->blocks_x;
+		break;
+	case LAYOUT_MORTON:
+		low = n & (((size_t)1 << 2 * l->zbits) - 1);
+		t->tx = compact(low);
+		t->ty = compact(low >> 1);
+		if (l->ztall)
+			t->ty |= (n >> 2 * l->zbits) << l->zbits;
+		else
+			t->tx |= (n >> 2 * l->zbits) << l->zbits;
+		if (t->tx >= l->blocks_x || t->ty >= l->blocks_y)
+			return -1;
+		break;
+	case LAYOUT_ROWS:
+	default:
+		t->tx = 0;
+		t->ty = n;
+		t->x0 = 0;
+		t->y0 = n;
+		t->w = l->width;
+		t->h = 1;
+		return 0;
+	}
+	t->x0 = t->tx << l->shift;
+	t->y0 = t->ty << l->shift;
+	t->w = l->width - t->x0 < size ? l->width - t->x0 : size;
+	t->h = l->height - t->y0 < size ? l->height - t->y0 : size;
+	return 0;
+}
+
+/* The distance in ints between vertically adjacent pixels of a block */
+static size_t block_pitch(const struct layout *l)
+{
+	return l->kind == LAYOUT_ROWS ? l->pitch : (size_t)1 << l->shift;
+}
+
+void layout_from_rows(const struct layout *l, int *dst, const int *src, size_t pitch)
+{
+	size_t n, bp = block_pitch(l);
+	struct tile t;
+	int *d;
+	int j;
+
+	for (n = 0; n < l->nblocks; n++) {
+		if (layout_block(l, n, &t) < 0)
+			continue;
+		d = dst + layout_offset(l, t.x0, t.y0);
+		for (j = 0; j < t.h; j++)
+			memcpy(d + j * bp, src + (t.y0 + j) * pitch + t.x0, t.w * sizeof(int));
+	}
+}
+
+void layout_to_rows(const struct layout *l, const int *src, int *dst, size_t pitch)
+{
+	size_t n, bp = block_pitch(l);
+	const int *s;
+	struct tile t;
+	int j;
+
+	for (n = 0; n < l->nblocks; n++) {
+		if (layout_block(l, n, &t) < 0)
+			continue;
+		s = src + layout_offset(l, t.x0, t.y0);
+		for (j = 0; j < t.h; j++)
+			memcpy(dst + (t.y0 + j) * pitch + t.x0, s + j * bp, t.w * sizeof(int));
+	}
+}
+
+void layout_render(const struct layout *l, const struct viewport *vp, int *dst)
+{
+	size_t n;
+	struct tile t;
+
+	for (n = 0; n < l->nblocks; n++)
+		if (layout_block(l, n, &t) == 0)
+			compute_mandel_tile(vp, &t, dst + layout_offset(l, t.x0, t.y0),
+					    block_pitch(l));
+}
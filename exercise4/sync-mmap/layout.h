@@ -0,0 +1,101 @@
+/*
+ * layout.h
+ *
+ * Frame layouts other than rows: the frame stored in square blocks,
+ * the blocks one after the other in row order (blocked) or in Z-order
+ * (Morton), so that pixels close together in 2D are close together in
+ * memory. Algorithms reading 2D neighbourhoods then touch a few cache
+ * lines and pages instead of a line and a page per row. A block of 1
+ * pixel gives a pure Morton layout.
+ *
+ * Rows are still what everything else (output, published frames)
+ * takes; layout_to_rows() converts.
+ *
+ */
+
+#ifndef LAYOUT_H__
+#define LAYOUT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tile.h"
+
+enum layout_kind {
+	LAYOUT_ROWS,		/* row-major, rows pitch ints apart */
+	LAYOUT_BLOCKED,		/* blocks in row order */
+	LAYOUT_MORTON		/* blocks in Z-order */
+};
+
+struct layout {
+	enum layout_kind kind;
+	int width, height;
+	size_t pitch;		/* LAYOUT_ROWS */
+	int shift;		/* blocks are 1 << shift pixels square */
+	int blocks_x, blocks_y;
+	int zbits;		/* LAYOUT_MORTON: low bits of bx and by interleaved */
+	int ztall;		/* the rest of the Z index is by's high bits, not bx's */
+	size_t nblocks;		/* block slots, padding included */
+	size_t size;		/* in ints */
+};
+
+/*
+ * Describe a width x height frame stored as kind; block is a power of
+ * two (ignored for rows, which get pitch width). Returns -1 if block
+ * is not a power of two.
+ */
+int layout_init(struct layout *l, enum layout_kind kind, int width, int height, int block);
+
+/* "rows", "blocked" or "morton"; 0 on success, -1 if unknown */
+int layout_parse(const char *s, enum layout_kind *kind);
+const char *layout_name(enum layout_kind kind);
+
+/* Spread the low 16 bits of v to the even bits */
+static inline uint32_t layout_spread(uint32_t v)
+{
+	v &= 0xffff;
+	v = (v | v << 8) & 0x00ff00ff;
+	v = (v | v << 4) & 0x0f0f0f0f;
+	v = (v | v << 2) & 0x33333333;
+	v = (v | v << 1) & 0x55555555;
+	return v;
+}
+
+/* Where pixel (x, y) is, in ints from the start of the frame */
+static inline size_t layout_offset(const struct layout *l, int x, int y)
+{
+	size_t mask = ((size_t)1 << l->shift) - 1, block;
+	uint32_t bx = x >> l->shift, by = y >> l->shift, low;
+
+	switch (l->kind) {
+	case LAYOUT_BLOCKED:
+		block = (size_t)by * l->blocks_x + bx;
+		break;
+	case LAYOUT_MORTON:
+		low = ((uint32_t)1 << l->zbits) - 1;
+		block = (size_t)(l->ztall ? by >> l->zbits : bx >> l->zbits) << 2 * l->zbits |
+			layout_spread(bx & low) | layout_spread(by & low) << 1;
+		break;
+	case LAYOUT_ROWS:
+	default:
+		return (size_t)y * l->pitch + x;
+	}
+	return block << 2 * l->shift | (y & mask) << l->shift | (x & mask);
+}
+
+/*
+ * Block slot n, 0 <= n < nblocks, in storage order, as a tile of the
+ * frame (for rows, row n); returns -1 for padding slots of a Morton
+ * layout, which hold no pixels. A block's rows are contiguous, 1 <<
+ * shift ints apart (pitch apart for rows).
+ */
+int layout_block(const struct layout *l, size_t n, struct tile *t);
+
+/* Convert between a layout and rows pitch ints apart */
+void layout_from_rows(const struct layout *l, int *dst, const int *src, size_t pitch);
+void layout_to_rows(const struct layout *l, const int *src, int *dst, size_t pitch);
+
+/* Compute the whole frame of vp into dst, block by block */
+void layout_render(const struct layout *l, const struct viewport *vp, int *dst);
+
+#endif /* LAYOUT_H__ */
@@ -0,0 +1,182 @@
+/*
+ * lazy.c
+ *
+ * Lazy frames on top of userfaultfd(2). The frame is an ordinary
+ * private anonymous mapping registered for missing-page faults, so a
+ * huge frame costs address space only. When a page is first touched,
+ * the faulting thread sleeps in the kernel while the handler thread
+ * computes every pixel that falls in that page (pieces of one or more
+ * rows) and copies the page in with UFFDIO_COPY, which wakes it up.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+
+#include "lazy.h"
+#include "tune.h"
+
+#ifndef UFFD_USER_MODE_ONLY
+# define UFFD_USER_MODE_ONLY	1
+#endif
+
+/* Compute the pixels of the page at byte offset off of the frame */
+static void fill_page(struct lazy_frame *lf, size_t off, int *buf, size_t page)
+{
+	const struct frame *f = &lf->frame;
+	size_t i = off / sizeof(int), end = (off + page) / sizeof(int), seg;
+	struct tile t = { 0 };
+	int col;
+
+	memset(buf, 0, page);
+	for (; i < end; i += seg) {
+		t.y0 = i / f->pitch;
+		col = i % f->pitch;
+		seg = f->pitch - col < end - i ? f->pitch - col : end - i;
+		if (t.y0 >= f->height)
+			break;		/* the end of the mapping */
+		if (col >= f->width)
+			continue;	/* row padding */
+		t.x0 = col;
+		t.w = col + seg < (size_t)f->width ? seg : f->width - col;
+		t.h = 1;
+		compute_mandel_tile(&lf->vp, &t, buf + (i - off / sizeof(int)), f->pitch);
+	}
+}
+
+static void *lazy_handler(void *arg)
+{
+	struct lazy_frame *lf = arg;
+	struct uffd_msg msg;
+	struct uffdio_copy copy;
+	struct pollfd pfd[2];
+	size_t page = sysconf(_SC_PAGE_SIZE);
+	unsigned long addr;
+	double start;
+
+	pfd[0].fd = lf->uffd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = lf->stop[0];
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("lazy: poll");
+			exit(1);
+		}
+		if (pfd[1].revents)
+			return NULL;
+		if (read(lf->uffd, &msg, sizeof(msg)) != sizeof(msg)) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			perror("lazy: read userfaultfd");
+			exit(1);
+		}
+		if (msg.event != UFFD_EVENT_PAGEFAULT)
+			continue;
+
+		addr = msg.arg.pagefault.address & ~(page - 1);
+		start = tune_now();
+		fill_page(lf, addr - (unsigned long)lf->frame.base, lf->page_buf, page);
+		lf->compute_time += tune_now() - start;
+		/* counted before the faulting thread is woken up and may look */
+		lf->pages++;
+
+		copy.dst = addr;
+		copy.src = (unsigned long)lf->page_buf;
+		copy.len = page;
+		copy.mode = 0;
+		copy.copy = 0;
+		/* EEXIST: another fault on the same page beat us to it */
+		if (ioctl(lf->uffd, UFFDIO_COPY, &copy) < 0 && errno != EEXIST) {
+			perror("lazy: UFFDIO_COPY");
+			exit(1);
+		}
+	}
+}
+
+static int open_uffd(void)
+{
+	int fd;
+
+	/* user-mode-only faults need no privileges on recent kernels */
+	fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+	if (fd < 0 && errno == EINVAL)
+		fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+	return fd;
+}
+
+int lazy_frame_create(struct lazy_frame *lf, int width, int height,
+		      const struct viewport *vp)
+{
+	struct uffdio_api api = { .api = UFFD_API };
+	struct uffdio_register reg;
+	int ret;
+
+	memset(lf, 0, sizeof(*lf));
+	lf->vp = *vp;
+	lf->uffd = open_uffd();
+	if (lf->uffd < 0) {
+		perror("userfaultfd");
+		return -1;
+	}
+	if (ioctl(lf->uffd, UFFDIO_API, &api) < 0) {
+		perror("UFFDIO_API");
+		close(lf->uffd);
+		return -1;
+	}
+
+	/*
+	 * Plain pages: huge pages would make every fault compute 2 MB.
+	 * Nothing is reserved, only touched pages ever exist.
+	 */
+	frame_alloc(&lf->frame, width, height, FRAME_NORESERVE);
+	reg.range.start = (unsigned long)lf->frame.base;
+	reg.range.len = lf->frame.mapped;
+	reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+	if (ioctl(lf->uffd, UFFDIO_REGISTER, &reg) < 0) {
+		perror("UFFDIO_REGISTER");
+		frame_free(&lf->frame);
+		close(lf->uffd);
+		return -1;
+	}
+
+	lf->page_buf = aligned_alloc(sysconf(_SC_PAGE_SIZE), sysconf(_SC_PAGE_SIZE));
+	if (lf->page_buf == NULL || pipe(lf->stop) < 0) {
+		perror("lazy_frame_create");
+		exit(1);
+	}
+	ret = pthread_create(&lf->handler, NULL, lazy_handler, lf);
+	if (ret) {
+		errno = ret;
+		perror("pthread_create");
+		exit(1);
+	}
+	return 0;
+}
+
+void lazy_frame_destroy(struct lazy_frame *lf)
+{
+	if (write(lf->stop[1], "", 1) != 1)
+		perror("lazy: write");
+	pthread_join(lf->handler, NULL);
+	close(lf->stop[0]);
+	close(lf->stop[1]);
+	frame_free(&lf->frame);
+	close(lf->uffd);
+	free(lf->page_buf);
+}
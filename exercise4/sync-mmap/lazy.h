@@ -0,0 +1,37 @@
+/*
+ * lazy.h
+ *
+ * Lazy frames: a frame that is mapped but not computed. A userfaultfd
+ * handler thread computes the pixels of a page the first time anyone
+ * touches it, and installs them with UFFDIO_COPY.
+ *
+ */
+
+#ifndef LAZY_H__
+#define LAZY_H__
+
+#include <pthread.h>
+
+#include "frame.h"
+#include "tile.h"
+
+struct lazy_frame {
+	struct frame frame;
+	struct viewport vp;
+	int uffd;
+	int stop[2];		/* a pipe telling the handler to leave */
+	pthread_t handler;
+	void *page_buf;		/* a page being computed */
+	unsigned long pages;	/* pages computed so far */
+	double compute_time;	/* seconds the handler spent computing them */
+};
+
+/*
+ * Map a width x height frame of viewport vp, to be computed on demand.
+ * Returns 0, or -1 if userfaultfd is not available.
+ */
+int lazy_frame_create(struct lazy_frame *lf, int width, int height,
+		      const struct viewport *vp);
+void lazy_frame_destroy(struct lazy_frame *lf);
+
+#endif /* LAZY_H__ */
@@ -0,0 +1,190 @@
+/*
+ * libmandel.c
+ *
+ * An engine is a mandel_job of its own, with a render_control and the
+ * CPU list its workers need, and renders by pointing the job's frame
+ * at the caller's buffer for the length of one backend->render().
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "libmandel.h"
+#include "backend.h"
+#include "equalize.h"
+#include "tune.h"
+
+/* The view mandel draws */
+#define DEFAULT_XMIN	-1.8
+#define DEFAULT_XMAX	1.0
+#define DEFAULT_YMIN	-1.0
+#define DEFAULT_YMAX	1.0
+#define DEFAULT_WIDTH	90
+#define DEFAULT_HEIGHT	50
+
+#define MAX_STEP	64
+
+struct mandel_engine {
+	const struct backend *backend;
+	enum mandel_kernel kernel;
+	int deadline_ms;
+	struct mandel_job job;
+	struct render_control ctl;
+	int *cpus;
+	struct mandel_stats stats;
+};
+
+void mandel_params_init(struct mandel_params *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->xmin = DEFAULT_XMIN;
+	p->xmax = DEFAULT_XMAX;
+	p->ymin = DEFAULT_YMIN;
+	p->ymax = DEFAULT_YMAX;
+	p->max_iter = MANDEL_MAX_ITERATION;
+	p->width = DEFAULT_WIDTH;
+	p->height = DEFAULT_HEIGHT;
+	p->kernel = MANDEL_KERNEL_COLORS;
+	p->step = 1;
+}
+
+static int valid_view(double xmin, double xmax, double ymin, double ymax, int max_iter)
+{
+	return xmin < xmax && ymin < ymax && max_iter > 0 && max_iter <= MANDEL_MAX_ITERATION;
+}
+
+static void set_view(struct mandel_engine *e, double xmin, double xmax,
+		     double ymin, double ymax, int max_iter)
+{
+	/* exactly as mandel computes them, for the same pixels */
+	e->job.vp = (struct viewport){ xmin, ymax, (xmax - xmin) / e->job.grid.width,
+				       (ymax - ymin) / e->job.grid.height, max_iter };
+}
+
+struct mandel_engine *mandel_engine_create(const struct mandel_params *p)
+{
+	struct mandel_engine *e;
+	const struct backend *backend;
+	int i, nworkers = p->nworkers;
+
+	if (!valid_view(p->xmin, p->xmax, p->ymin, p->ymax, p->max_iter) ||
+	    p->width <= 0 || p->height <= 0 || nworkers < 0 || nworkers > MANDEL_MAX_WORKERS ||
+	    p->deadline_ms < 0 ||
+	    p->kernel < MANDEL_KERNEL_COLORS || p->kernel > MANDEL_KERNEL_EQUALIZED ||
+	    p->step <= 0 || p->step > MAX_STEP || (p->step & (p->step - 1)) ||
+	    (p->step > 1 && p->kernel != MANDEL_KERNEL_COLORS)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	backend = backend_find(p->backend ? p->backend : "pthread-sem");
+	if (backend == NULL || !backend->in_process) {
+		errno = ENOENT;
+		return NULL;
+	}
+	if (nworkers == 0 && (nworkers = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+		nworkers = 1;
+	if (nworkers > MANDEL_MAX_WORKERS)
+		nworkers = MANDEL_MAX_WORKERS;
+	/* fill the palette now rather than in the workers of a render */
+	mandel_palette(0);
+
+	if ((e = calloc(1, sizeof(*e))) == NULL)
+		return NULL;
+	if ((e->cpus = malloc(nworkers * sizeof(*e->cpus))) == NULL) {
+		free(e);
+		return NULL;
+	}
+	for (i = 0; i < nworkers; i++)
+		e->cpus[i] = -1;
+	e->backend = backend;
+	e->kernel = p->kernel;
+	e->deadline_ms = p->deadline_ms;
+
+	/* rows, or bands of them as high as a block of a coarse pass */
+	tile_grid_init(&e->job.grid, p->width, p->height, p->width, p->step, TILE_ORDER_ROWS);
+	set_view(e, p->xmin, p->xmax, p->ymin, p->ymax, p->max_iter);
+	e->job.nworkers = nworkers;
+	e->job.chunk = 1;
+	e->job.cpus = e->cpus;
+	e->job.threads = 1;
+	e->job.ctl = &e->ctl;
+	e->job.iterations = p->kernel != MANDEL_KERNEL_COLORS;
+	/* a single pass of a progressive render is a coarse frame */
+	if (p->step > 1)
+		e->job.progressive = e->job.step = p->step;
+	e->job.fd = -1;
+	return e;
+}
+
+void mandel_engine_destroy(struct mandel_engine *e)
+{
+	if (e == NULL)
+		return;
+	free(e->cpus);
+	free(e);
+}
+
+int mandel_engine_set_view(struct mandel_engine *e, double xmin, double xmax,
+			   double ymin, double ymax, int max_iter)
+{
+	if (!valid_view(xmin, xmax, ymin, ymax, max_iter)) {
+		errno = EINVAL;
+		return -1;
+	}
+	set_view(e, xmin, xmax, ymin, ymax, max_iter);
+	return 0;
+}
+
+int mandel_engine_render(struct mandel_engine *e, int *buf, size_t pitch)
+{
+	struct frame frame = {
+		.base = buf,
+		.pitch = pitch,
+		.width = e->job.grid.width,
+		.height = e->job.grid.height,
+		.pub_fd = -1,
+	};
+	struct equalize_stats eq = { 0 };
+	double start = tune_now();
+	int ret, err;
+
+	if (pitch < (size_t)frame.width) {
+		errno = EINVAL;
+		return -1;
+	}
+	e->ctl.deadline = e->deadline_ms ? start + e->deadline_ms / 1e3 : 0;
+	e->ctl.expired = 0;
+	e->ctl.approximated = 0;
+	__atomic_store_n(&e->ctl.interrupted, 0, __ATOMIC_RELAXED);
+
+	e->job.frame = &frame;
+	ret = e->backend->render(&e->job);
+	e->job.frame = NULL;
+	if (ret == 0 && e->kernel == MANDEL_KERNEL_EQUALIZED)
+		ret = equalize_frame(&frame, &frame, e->job.vp.max_iter, e->job.nworkers, &eq);
+	err = errno;
+
+	e->stats.renders++;
+	e->stats.last = tune_now() - start;
+	e->stats.total += e->stats.last;
+	e->stats.equalize = eq.histogram + eq.merge + eq.scan + eq.map;
+	e->stats.approximated = e->ctl.approximated;
+	e->stats.interrupted = e->ctl.interrupted;
+	errno = err;
+	if (ret < 0)
+		return -1;
+	return e->ctl.approximated ? 1 : 0;
+}
+
+void mandel_engine_interrupt(struct mandel_engine *e)
+{
+	render_interrupt(&e->ctl);
+}
+
+void mandel_engine_stats(const struct mandel_engine *e, struct mandel_stats *st)
+{
+	*st = e->stats;
+}
@@ -0,0 +1,106 @@
+/*
+ * libmandel.h
+ *
+ * libmandel: the renderer as a library. An engine holds everything a
+ * render needs (view, frame size, coloring, backend, workers and the
+ * numbers of its last renders), and renders straight into a buffer of
+ * the caller's, so a program can draw frames without spawning mandel
+ * and parsing its output. Engines share no mutable state (the only
+ * global is the palette, filled once as the first engine is created,
+ * see tile.h): any number of them may be used at once, each from one
+ * thread at a time.
+ *
+ * Only the backends whose workers are threads of the calling process
+ * are offered (pthread-sem, pthread-cond, c11 and, when built with
+ * OpenMP, omp); the others fork() the caller or keep workers between
+ * frames. Link with -lmandel -pthread -lm, and -fopenmp for a static
+ * libmandel.a built with OpenMP.
+ *
+ */
+
+#ifndef LIBMANDEL_H__
+#define LIBMANDEL_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MANDEL_MAX_WORKERS	1024
+
+/* What the pixels of a frame hold */
+enum mandel_kernel {
+	MANDEL_KERNEL_COLORS,		/* xterm colors, as mandel prints them */
+	MANDEL_KERNEL_ITERATIONS,	/* iteration counts, up to max_iter */
+	MANDEL_KERNEL_EQUALIZED		/* xterm colors, histogram-equalized (-e) */
+};
+
+struct mandel_params {
+	double xmin, xmax, ymin, ymax;	/* the part of the plane drawn */
+	int max_iter;
+	int width, height;		/* of the frame, in pixels */
+	enum mandel_kernel kernel;
+	/*
+	 * Precision of the samples: every step-th pixel of every step-th
+	 * row is computed, and fills its step x step block. 1 computes
+	 * every pixel; powers of two up to 64, for previews, and only with
+	 * MANDEL_KERNEL_COLORS.
+	 */
+	int step;
+	const char *backend;		/* NULL for pthread-sem */
+	int nworkers;			/* 0 for one per CPU, up to MANDEL_MAX_WORKERS */
+	int deadline_ms;		/* approximate what is left after; 0 for none */
+};
+
+/* Fill in the defaults: mandel's view and frame, every pixel, colors */
+void mandel_params_init(struct mandel_params *p);
+
+struct mandel_stats {
+	unsigned long renders;		/* since the engine was created */
+	double last, total;		/* seconds of render, the last and all */
+	double equalize;		/* of the last render, included in last */
+	unsigned int approximated;	/* tiles of the last render, see render.h */
+	int interrupted;		/* the last render was interrupted */
+};
+
+struct mandel_engine;
+
+/*
+ * Create an engine. Returns NULL with errno set on failure: EINVAL for
+ * parameters out of range, ENOENT for a backend not offered, ENOMEM.
+ */
+struct mandel_engine *mandel_engine_create(const struct mandel_params *p);
+void mandel_engine_destroy(struct mandel_engine *e);
+
+/*
+ * Move the view of the frame, keeping its size, kernel and backend;
+ * 0 on success, -1 with errno EINVAL if the view is not valid.
+ */
+int mandel_engine_set_view(struct mandel_engine *e, double xmin, double xmax,
+			   double ymin, double ymax, int max_iter);
+
+/*
+ * Render a frame into buf: pixel (x, y) goes to buf[y * pitch + x],
+ * pitch in ints and at least the width. Returns 0 on success, 1 if the
+ * frame is partial (the deadline passed, or the render was interrupted)
+ * and -1 with errno set if it failed (EINVAL for a short pitch, EAGAIN
+ * if the workers could not be started), in which case buf holds no
+ * whole frame. Exits on out of memory, like the rest of the renderer.
+ */
+int mandel_engine_render(struct mandel_engine *e, int *buf, size_t pitch);
+
+/*
+ * Have the render in progress approximate the tiles left, as SIGINT
+ * does in mandel. May be called from any thread, or a signal handler;
+ * the next render starts afresh.
+ */
+void mandel_engine_interrupt(struct mandel_engine *e);
+
+void mandel_engine_stats(const struct mandel_engine *e, struct mandel_stats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBMANDEL_H__ */
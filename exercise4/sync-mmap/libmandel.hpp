@@ -0,0 +1,97 @@
+/*
+ * libmandel.hpp
+ *
+ * C++ wrapper of libmandel.h: an Engine owns a mandel_engine, is
+ * movable but not copyable, and throws std::system_error where the C
+ * calls return an error.
+ *
+ */
+
+#ifndef LIBMANDEL_HPP__
+#define LIBMANDEL_HPP__
+
+#include <cerrno>
+#include <cstddef>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "libmandel.h"
+
+namespace mandel {
+
+class Params : public mandel_params {
+public:
+	Params() { mandel_params_init(this); }
+};
+
+class Engine {
+public:
+	explicit Engine(const mandel_params &p = Params())
+		: e_(mandel_engine_create(&p)), width_(p.width), height_(p.height)
+	{
+		if (!e_)
+			throw std::system_error(errno, std::generic_category(),
+						"mandel_engine_create");
+	}
+	~Engine() { mandel_engine_destroy(e_); }
+
+	Engine(const Engine &) = delete;
+	Engine &operator=(const Engine &) = delete;
+	Engine(Engine &&o) noexcept
+		: e_(std::exchange(o.e_, nullptr)), width_(o.width_), height_(o.height_) {}
+	Engine &operator=(Engine &&o) noexcept
+	{
+		std::swap(e_, o.e_);
+		std::swap(width_, o.width_);
+		std::swap(height_, o.height_);
+		return *this;
+	}
+
+	void set_view(double xmin, double xmax, double ymin, double ymax, int max_iter)
+	{
+		if (mandel_engine_set_view(e_, xmin, xmax, ymin, ymax, max_iter) < 0)
+			throw std::system_error(errno, std::generic_category(),
+						"mandel_engine_set_view");
+	}
+
+	/* true for a whole frame, false for a partial one */
+	bool render(int *buf, std::size_t pitch)
+	{
+		int ret = mandel_engine_render(e_, buf, pitch);
+
+		if (ret < 0)
+			throw std::system_error(errno ? errno : EIO, std::generic_category(),
+						"mandel_engine_render");
+		return ret == 0;
+	}
+
+	/* buf is resized to the frame, rows packed */
+	bool render(std::vector<int> &buf)
+	{
+		buf.resize(static_cast<std::size_t>(width_) * height_);
+		return render(buf.data(), width_);
+	}
+
+	void interrupt() { mandel_engine_interrupt(e_); }
+
+	mandel_stats stats() const
+	{
+		mandel_stats st;
+
+		mandel_engine_stats(e_, &st);
+		return st;
+	}
+
+	int width() const { return width_; }
+	int height() const { return height_; }
+	mandel_engine *get() const { return e_; }
+
+private:
+	mandel_engine *e_;
+	int width_, height_;
+};
+
+} /* namespace mandel */
+
+#endif /* LIBMANDEL_HPP__ */
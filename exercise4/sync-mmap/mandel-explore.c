@@ -0,0 +1,754 @@
+/*
+ * mandel-explore.c
+ *
+ * Explore the Mandelbrot set interactively on a 256-color xterm:
+ * the keyboard pans and zooms, every key press re-renders the view
+ * and the window follows the terminal size (SIGWINCH).
+ *
+ * Pixels that are still on screen after a pan, a 2x zoom or a resize
+ * are kept, so only the newly exposed pixels are computed. A render
+ * in flight is cancelled as soon as the next key arrives: workers
+ * check a flag between runs of pixels and the main thread waits for
+ * them to let go of the frame before moving it. The status line shows
+ * the time from a key press to the new picture on the screen.
+ *
+ * Once a frame is on the screen, the idle threads compute the views
+ * one key away (the last move first, then the other pans and zooms).
+ * Those are only kept until the next key, which cancels them like any
+ * render and takes whatever pixels of its view they had done.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "../helpers/mandel-lib.h"
+#include "render.h"
+#include "tune.h"
+
+/* The view we start from, and return to on `r', as in mandel */
+#define XMIN	-1.8
+#define XMAX	1.0
+#define YMIN	-1.0
+#define YMAX	1.0
+
+#define LAT_SAMPLES	1024		/* latency percentiles over the last frames */
+#define KEYBUF		64
+#define NSPEC		6		/* views computed ahead */
+#define SPEC_RUN	16		/* pixels between cancel checks when speculating */
+
+/*
+ * What is on the screen: a frame and, for each of its pixels, whether
+ * it holds the color of that pixel in the current viewport.
+ */
+struct view {
+	struct frame frame;
+	unsigned char *valid;		/* width * height flags */
+	struct viewport vp;
+	int reused;			/* pixels kept by the last remap */
+	int prefetched;			/* pixels taken from a speculative view */
+};
+
+/*
+ * The render threads. A render is started by bumping gen; each thread
+ * takes rows from next_row and computes their invalid pixels until
+ * the rows run out or cancel is set. The last one to stop writes a
+ * byte to the done pipe. A render covers one view, or the speculative
+ * views one after the other (all of the same size), row n of the lot
+ * being row n % height of view n / height.
+ */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned long gen;
+	int active;			/* threads still working on gen */
+	int next_row;
+	int cancel;
+	int done[2];
+	struct view *views[NSPEC];
+	int nviews;
+	int run;			/* pixels between cancel checks, 0: a whole run */
+} render = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static struct termios saved_termios;
+static int wake[2];			/* written to by the signal handlers */
+static volatile sig_atomic_t quit, resized;
+
+/************
+ * Terminal *
+ ************/
+
+static void restore_terminal(void)
+{
+	static const char leave[] = "\033[0m\033[?25h\033[?1049l";
+	static int restored;
+
+	if (restored++)
+		return;
+	tcsetattr(0, TCSAFLUSH, &saved_termios);
+	if (write(1, leave, sizeof(leave) - 1) < 0)
+		perror("write");
+}
+
+/*
+ * Keys are read one at a time without echo, but Ctrl-C still sends
+ * SIGINT and output processing stays on, so "\n" is still a newline.
+ */
+static void setup_terminal(void)
+{
+	static const char enter[] = "\033[?1049h\033[?25l\033[2J";
+	struct termios t;
+
+	if (tcgetattr(0, &saved_termios) < 0) {
+		perror("tcgetattr");
+		exit(1);
+	}
+	t = saved_termios;
+	t.c_lflag &= ~(ICANON | ECHO);
+	t.c_cc[VMIN] = 1;
+	t.c_cc[VTIME] = 0;
+	if (tcsetattr(0, TCSAFLUSH, &t) < 0) {
+		perror("tcsetattr");
+		exit(1);
+	}
+	atexit(restore_terminal);
+	if (insist_write(1, enter, sizeof(enter) - 1) < 0) {
+		perror("write");
+		exit(1);
+	}
+}
+
+/* The frame gets all rows of the terminal but the status line */
+static void terminal_size(int *width, int *height)
+{
+	struct winsize ws;
+
+	if (ioctl(1, TIOCGWINSZ, &ws) < 0 || ws.ws_col == 0 || ws.ws_row < 2) {
+		*width = 90;
+		*height = 50;
+		return;
+	}
+	*width = ws.ws_col;
+	*height = ws.ws_row - 1;
+}
+
+static void signal_handler(int signum)
+{
+	int saved = errno;
+
+	if (signum == SIGWINCH)
+		resized = 1;
+	else
+		quit = 1;
+	if (write(wake[1], "", 1) < 0)
+		;	/* the pipe is full: a wake-up is pending anyway */
+	errno = saved;
+}
+
+/********
+ * View *
+ ********/
+
+static void view_alloc(struct view *v, int width, int height)
+{
+	frame_alloc(&v->frame, width, height, 0);
+	v->valid = calloc((size_t)width * height, 1);
+	if (v->valid == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+}
+
+static void view_reset(struct view *v, int max_iter)
+{
+	v->vp.xmin = XMIN;
+	v->vp.ymax = YMAX;
+	v->vp.xstep = (XMAX - XMIN) / v->frame.width;
+	v->vp.ystep = (YMAX - YMIN) / v->frame.height;
+	v->vp.max_iter = max_iter;
+	memset(v->valid, 0, (size_t)v->frame.width * v->frame.height);
+	v->reused = 0;
+}
+
+/* A copy of src, with a frame of its own */
+static void view_clone(struct view *dst, const struct view *src)
+{
+	int r;
+
+	view_alloc(dst, src->frame.width, src->frame.height);
+	for (r = 0; r < src->frame.height; r++)
+		memcpy(frame_row(&dst->frame, r), frame_row(&src->frame, r),
+		       src->frame.width * sizeof(int));
+	memcpy(dst->valid, src->valid, (size_t)src->frame.width * src->frame.height);
+	dst->vp = src->vp;
+	dst->reused = src->reused;
+	dst->prefetched = 0;
+}
+
+/*
+ * Move the view to a width x height frame whose pixel (c, r) is at
+ * (ox + c * k / 2, oy + r * k / 2) in the old one: k = 2 pans by
+ * (ox, oy) or resizes, k = 1 zooms in 2x and k = 4 zooms out 2x.
+ * Old pixels landing exactly on a new one are kept, the others are
+ * left to compute.
+ */
+static void view_remap(struct view *v, int width, int height, int k, int ox, int oy)
+{
+	struct view old = *v;
+	int r, c, or2, oc2, orow, ocol;
+
+	view_alloc(v, width, height);
+	v->reused = 0;
+	v->prefetched = 0;
+	for (r = 0; r < height; r++) {
+		or2 = 2 * oy + r * k;
+		orow = or2 / 2;
+		if (or2 < 0 || or2 & 1 || orow >= old.frame.height)
+			continue;
+		for (c = 0; c < width; c++) {
+			oc2 = 2 * ox + c * k;
+			ocol = oc2 / 2;
+			if (oc2 < 0 || oc2 & 1 || ocol >= old.frame.width ||
+			    !old.valid[orow * old.frame.width + ocol])
+				continue;
+			frame_row(&v->frame, r)[c] = frame_row(&old.frame, orow)[ocol];
+			v->valid[r * width + c] = 1;
+			v->reused++;
+		}
+	}
+	v->vp.xmin = old.vp.xmin + ox * old.vp.xstep;
+	v->vp.ymax = old.vp.ymax - oy * old.vp.ystep;
+	v->vp.xstep = old.vp.xstep * k / 2;
+	v->vp.ystep = old.vp.ystep * k / 2;
+
+	frame_free(&old.frame);
+	free(old.valid);
+}
+
+/*************
+ * Rendering *
+ *************/
+
+/* Compute the runs of invalid pixels of a row, at most `run' at a time */
+static void render_row(struct view *v, int row, int run)
+{
+	unsigned char *valid = v->valid + (size_t)row * v->frame.width;
+	struct tile t = { .y0 = row, .h = 1 };
+	int c = 0;
+
+	while (c < v->frame.width && !__atomic_load_n(&render.cancel, __ATOMIC_RELAXED)) {
+		if (valid[c]) {
+			c++;
+			continue;
+		}
+		for (t.x0 = c; c < v->frame.width && !valid[c] && (!run || c - t.x0 < run); c++)
+			;
+		t.w = c - t.x0;
+		compute_mandel_tile(&v->vp, &t, frame_row(&v->frame, row) + t.x0, v->frame.pitch);
+		memset(valid + t.x0, 1, t.w);
+	}
+}
+
+static void *render_thread(void *arg)
+{
+	unsigned long seen = 0;
+	struct view *views[NSPEC];
+	int row, nviews, height, run;
+
+	for (;;) {
+		pthread_mutex_lock(&render.lock);
+		while (render.gen == seen)
+			pthread_cond_wait(&render.cond, &render.lock);
+		seen = render.gen;
+		nviews = render.nviews;
+		memcpy(views, render.views, nviews * sizeof(*views));
+		run = render.run;
+		pthread_mutex_unlock(&render.lock);
+
+		height = views[0]->frame.height;
+		while (!__atomic_load_n(&render.cancel, __ATOMIC_RELAXED)) {
+			row = __atomic_fetch_add(&render.next_row, 1, __ATOMIC_RELAXED);
+			if (row >= nviews * height)
+				break;
+			render_row(views[row / height], row % height, run);
+		}
+
+		pthread_mutex_lock(&render.lock);
+		if (--render.active == 0) {
+			pthread_cond_broadcast(&render.cond);
+			if (write(render.done[1], "", 1) != 1)
+				perror("write");
+		}
+		pthread_mutex_unlock(&render.lock);
+	}
+	return NULL;
+}
+
+static void render_start(struct view *const *views, int nviews, int run, int nthreads)
+{
+	pthread_mutex_lock(&render.lock);
+	memcpy(render.views, views, nviews * sizeof(*views));
+	render.nviews = nviews;
+	render.run = run;
+	render.next_row = 0;
+	render.cancel = 0;
+	render.active = nthreads;
+	render.gen++;
+	pthread_cond_broadcast(&render.cond);
+	pthread_mutex_unlock(&render.lock);
+}
+
+/*
+ * Stop the render in flight, if any, and wait until no thread touches
+ * the view. Returns 1 if it was cut short, 0 if it had finished.
+ */
+static int render_cancel(void)
+{
+	char buf[16];
+	int cut;
+
+	pthread_mutex_lock(&render.lock);
+	cut = render.active > 0;
+	__atomic_store_n(&render.cancel, 1, __ATOMIC_RELAXED);
+	while (render.active > 0)
+		pthread_cond_wait(&render.cond, &render.lock);
+	pthread_mutex_unlock(&render.lock);
+	/* nobody is waiting for that frame anymore */
+	while (read(render.done[0], buf, sizeof(buf)) == sizeof(buf))
+		;
+	return cut;
+}
+
+/***************
+ * Speculation *
+ ***************/
+
+static struct {
+	struct view views[NSPEC];
+	char keys[NSPEC];		/* the key leading to each view */
+	int n;
+	unsigned long moves, hits;	/* moves made while speculating, found complete */
+	unsigned long needed, found;	/* pixels those moves had to compute, found */
+} spec;
+
+static int key_move(struct view *v, char key, int max_iter0);
+
+/* Forget the speculative views; the threads must be done with them */
+static void spec_discard(void)
+{
+	int i;
+
+	for (i = 0; i < spec.n; i++) {
+		frame_free(&spec.views[i].frame);
+		free(spec.views[i].valid);
+	}
+	spec.n = 0;
+}
+
+/*
+ * Start computing the views one key away from v, the last move first
+ * since pans and zooms tend to come in runs.
+ */
+static void spec_start(const struct view *v, char last, int nthreads)
+{
+	static const char moves[] = "lhjk+-";
+	struct view *views[NSPEC];
+	int i;
+
+	spec_discard();
+	if (last)
+		spec.keys[spec.n++] = last;
+	for (i = 0; moves[i]; i++)
+		if (moves[i] != last)
+			spec.keys[spec.n++] = moves[i];
+	for (i = 0; i < spec.n; i++) {
+		view_clone(&spec.views[i], v);
+		key_move(&spec.views[i], spec.keys[i], 0);
+		views[i] = &spec.views[i];
+	}
+	render_start(views, spec.n, SPEC_RUN, nthreads);
+}
+
+/*
+ * v has just been moved by key: take the pixels it lacks from the view
+ * speculated for that key, which has the very same viewport.
+ */
+static void spec_adopt(struct view *v, char key)
+{
+	struct view *s = NULL;
+	int i, r, c, w = v->frame.width, needed = 0, found = 0;
+
+	for (i = 0; i < spec.n; i++)
+		if (spec.keys[i] == key)
+			s = &spec.views[i];
+	spec.moves++;
+	for (r = 0; r < v->frame.height; r++) {
+		for (c = 0; c < w; c++) {
+			if (v->valid[r * w + c])
+				continue;
+			needed++;
+			if (s == NULL || !s->valid[r * w + c] ||
+			    memcmp(&s->vp, &v->vp, sizeof(v->vp)) != 0 || s->frame.width != w)
+				continue;
+			frame_row(&v->frame, r)[c] = frame_row(&s->frame, r)[c];
+			v->valid[r * w + c] = 1;
+			found++;
+		}
+	}
+	v->prefetched = found;
+	spec.needed += needed;
+	spec.found += found;
+	spec.hits += found == needed;
+}
+
+/**********
+ * Screen *
+ **********/
+
+/*
+ * Draw the frame with one write(), changing color only when it changes,
+ * so that the terminal never shows half of the old picture.
+ */
+static void draw_frame(const struct view *v)
+{
+	size_t len = 0, size = (size_t)v->frame.width * v->frame.height * 12 + v->frame.height + 16;
+	char *buf = malloc(size);
+	int r, c, color, last = -1;
+	const int *row;
+
+	if (buf == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	len += sprintf(buf, "\033[H");
+	for (r = 0; r < v->frame.height; r++) {
+		row = frame_row(&v->frame, r);
+		for (c = 0; c < v->frame.width; c++) {
+			color = row[c];
+			if (color != last)
+				len += sprintf(buf + len, "\033[38;5;%dm", color);
+			buf[len++] = '@';
+			last = color;
+		}
+		buf[len++] = '\n';
+	}
+	if (insist_write(1, buf, len) != (ssize_t)len) {
+		perror("draw_frame: write");
+		exit(1);
+	}
+	free(buf);
+}
+
+static void draw_status(const struct view *v, const char *text)
+{
+	char buf[512];
+	int len, width = v->frame.width < 400 ? v->frame.width : 400;
+
+	len = snprintf(buf, sizeof(buf), "\033[%d;1H\033[0m\033[2K%.*s",
+		       v->frame.height + 1, width, text);
+	if (insist_write(1, buf, len) != len) {
+		perror("draw_status: write");
+		exit(1);
+	}
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void percentiles(const double *lat, unsigned long nlat, double *p50, double *p99)
+{
+	double sorted[LAT_SAMPLES];
+	unsigned long n = nlat < LAT_SAMPLES ? nlat : LAT_SAMPLES;
+
+	*p50 = *p99 = 0;
+	if (n == 0)
+		return;
+	memcpy(sorted, lat, n * sizeof(*sorted));
+	qsort(sorted, n, sizeof(*sorted), cmp_double);
+	*p50 = sorted[(n - 1) * 50 / 100];
+	*p99 = sorted[(n - 1) * 99 / 100];
+}
+
+/********
+ * Keys *
+ ********/
+
+/* Apply one key to the view. Returns 1 for pans and zooms, 0 otherwise. */
+static int key_move(struct view *v, char key, int max_iter0)
+{
+	int w = v->frame.width, h = v->frame.height;
+	int dx = w / 8 ? w / 8 : 1, dy = h / 8 ? h / 8 : 1;
+
+	switch (key) {
+	case 'h':
+		view_remap(v, w, h, 2, -dx, 0);
+		return 1;
+	case 'l':
+		view_remap(v, w, h, 2, dx, 0);
+		return 1;
+	case 'k':
+		view_remap(v, w, h, 2, 0, -dy);
+		return 1;
+	case 'j':
+		view_remap(v, w, h, 2, 0, dy);
+		return 1;
+	case '+':
+		view_remap(v, w, h, 1, w / 4, h / 4);
+		return 1;
+	case '-':
+		view_remap(v, w, h, 4, -2 * (w / 4), -2 * (h / 4));
+		return 1;
+	case ']':
+	case '[':
+		if (key == ']' && v->vp.max_iter <= MANDEL_MAX_ITERATION / 2)
+			v->vp.max_iter *= 2;
+		else if (key == '[' && v->vp.max_iter >= 2)
+			v->vp.max_iter /= 2;
+		memset(v->valid, 0, (size_t)w * h);
+		v->reused = v->prefetched = 0;
+		break;
+	case 'r':
+		view_reset(v, max_iter0);
+		break;
+	case 'q':
+		quit = 1;
+		break;
+	}
+	return 0;
+}
+
+/*
+ * Apply the keys in buf to the view. Returns the number of bytes used:
+ * an escape sequence cut in half is left for the next read. *last is
+ * set to the last pan or zoom.
+ */
+static int apply_keys(struct view *v, const char *buf, int len, int max_iter0, char *last)
+{
+	int i = 0;
+	char key;
+
+	while (i < len) {
+		key = buf[i];
+		if (key == '\033') {
+			if (i + 1 == len || (buf[i + 1] == '[' && i + 2 == len))
+				break;
+			if (buf[i + 1] != '[') {
+				i++;
+				continue;
+			}
+			/* arrows: ESC [ A..D */
+			key = "kjlh"[(buf[i + 2] - 'A') & 3];
+			if (buf[i + 2] < 'A' || buf[i + 2] > 'D')
+				key = 0;
+			i += 3;
+		} else {
+			i++;
+		}
+		if (key == '=')
+			key = '+';
+		if (key_move(v, key, max_iter0)) {
+			*last = key;
+			/* the speculation was done from where this key started */
+			if (spec.n)
+				spec_adopt(v, key);
+		}
+		spec_discard();
+	}
+	return i;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-t threads] [-i iter]\n\n"
+		"  -t threads: render threads. Default: the number of CPUs.\n"
+		"  -i iter:    iteration cap. Default: 1000.\n\n"
+		"Keys: arrows or h/j/k/l pan, + and - zoom 2x, ] and [ double and\n"
+		"halve the iteration cap, r resets the view, q quits.\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct view view, *cur = &view;
+	struct sigaction sa;
+	struct pollfd pfd[3];
+	pthread_t tid;
+	char keys[KEYBUF], status[512], c, last = 0;
+	double lat[LAT_SAMPLES], pressed = 0, started = 0, p50, p99, now;
+	unsigned long nlat = 0, frames = 0, cancelled = 0, preempted = 0;
+	int opt, nthreads, max_iter = 1000, width, height, nkeys = 0, n, i, ret;
+	int speculating = 0;
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "t:i:")) != -1) {
+		switch (opt) {
+		case 't':
+			if (safe_atoi(optarg, &nthreads) < 0)
+				usage(argv[0]);
+			break;
+		case 'i':
+			if (safe_atoi(optarg, &max_iter) < 0)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc != optind || nthreads <= 0 || max_iter <= 0 || max_iter > MANDEL_MAX_ITERATION)
+		usage(argv[0]);
+	if (!isatty(0) || !isatty(1)) {
+		fprintf(stderr, "%s: needs a terminal\n", argv[0]);
+		exit(1);
+	}
+
+	if (pipe(wake) < 0 || pipe(render.done) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+	for (i = 0; i < 2; i++) {
+		if (fcntl(wake[i], F_SETFL, O_NONBLOCK) < 0 ||
+		    fcntl(render.done[i], F_SETFL, O_NONBLOCK) < 0) {
+			perror("fcntl");
+			exit(1);
+		}
+	}
+	sa.sa_handler = signal_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGWINCH, &sa, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_create(&tid, NULL, render_thread, NULL);
+		if (ret) {
+			errno = ret;
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+
+	setup_terminal();
+	terminal_size(&width, &height);
+	view_alloc(&view, width, height);
+	view_reset(&view, max_iter);
+	started = tune_now();
+	render_start(&cur, 1, 0, nthreads);
+
+	pfd[0].fd = 0;
+	pfd[1].fd = wake[0];
+	pfd[2].fd = render.done[0];
+	pfd[0].events = pfd[1].events = pfd[2].events = POLLIN;
+	while (!quit) {
+		if (poll(pfd, 3, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			exit(1);
+		}
+		if (pfd[1].revents)
+			while (read(wake[0], &c, 1) == 1)
+				;
+		if (pfd[0].revents) {
+			n = read(0, keys + nkeys, sizeof(keys) - nkeys);
+			if (n <= 0)
+				break;
+			nkeys += n;
+		}
+		if (quit)
+			break;
+
+		/* new input: drop the render in flight and start over */
+		if ((pfd[0].revents && nkeys > 0) || resized) {
+			if (pressed == 0)
+				pressed = tune_now();
+			if (speculating)
+				preempted += render_cancel();
+			else
+				cancelled += render_cancel();
+			speculating = 0;
+			if (resized) {
+				resized = 0;
+				terminal_size(&width, &height);
+				if (width != view.frame.width || height != view.frame.height) {
+					spec_discard();
+					view_remap(&view, width, height, 2, 0, 0);
+					if (insist_write(1, "\033[0m\033[2J", 8) != 8)
+						exit(1);
+				}
+			}
+			n = apply_keys(&view, keys, nkeys, max_iter, &last);
+			memmove(keys, keys + n, nkeys - n);
+			nkeys -= n;
+			if (quit)
+				break;
+			started = tune_now();
+			render_start(&cur, 1, 0, nthreads);
+			continue;
+		}
+
+		if (pfd[2].revents) {
+			while (read(render.done[0], &c, 1) == 1)
+				;
+			if (speculating) {
+				/* all views one key away are ready */
+				speculating = 0;
+				continue;
+			}
+			draw_frame(&view);
+			now = tune_now();
+			if (pressed != 0) {
+				lat[nlat++ % LAT_SAMPLES] = now - pressed;
+				pressed = 0;
+			}
+			frames++;
+			percentiles(lat, nlat, &p50, &p99);
+			snprintf(status, sizeof(status),
+				 "x %.10g y %.10g zoom %.3gx iter %d | key->screen %.1f ms "
+				 "(render %.1f ms, %d%% reused, %d%% prefetched) p50 %.1f p99 %.1f ms | "
+				 "prefetch hits %lu/%lu | %lu cancelled",
+				 view.vp.xmin + view.frame.width / 2 * view.vp.xstep,
+				 view.vp.ymax - view.frame.height / 2 * view.vp.ystep,
+				 (XMAX - XMIN) / (view.frame.width * view.vp.xstep), view.vp.max_iter,
+				 nlat ? lat[(nlat - 1) % LAT_SAMPLES] * 1e3 : 0, (now - started) * 1e3,
+				 (int)(100.0 * view.reused / ((size_t)view.frame.width * view.frame.height)),
+				 (int)(100.0 * view.prefetched / ((size_t)view.frame.width * view.frame.height)),
+				 p50 * 1e3, p99 * 1e3, spec.hits, spec.moves, cancelled);
+			draw_status(&view, status);
+
+			/* nothing to do until the next key: guess it */
+			spec_start(&view, last, nthreads);
+			speculating = 1;
+		}
+	}
+
+	render_cancel();
+	spec_discard();
+	restore_terminal();
+	percentiles(lat, nlat, &p50, &p99);
+	fprintf(stderr, "%s: %lu frames, %lu renders cancelled, key->screen p50 %.1f ms p99 %.1f ms\n",
+		argv[0], frames, cancelled, p50 * 1e3, p99 * 1e3);
+	fprintf(stderr, "%s: prefetch: %lu of %lu moves found complete, %lu of %lu pixels "
+		"(%.1f%%), %lu speculations pre-empted\n",
+		argv[0], spec.hits, spec.moves, spec.found, spec.needed,
+		spec.needed ? 100.0 * spec.found / spec.needed : 0, preempted);
+	frame_free(&view.frame);
+	free(view.valid);
+	return 0;
+}
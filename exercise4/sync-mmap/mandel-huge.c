@@ -0,0 +1,295 @@
+/*
+ * mandel-huge.c
+ *
+ * Render an image far larger than memory, e.g. 100000x100000, into a
+ * PGM file of xterm color values, in a fixed memory budget.
+ *
+ * The image is cut into stripes of full rows, as many rows as half the
+ * budget holds, and the stripes into tiles of tile_w x BAND_H pixels,
+ * so that even a narrow image gives every worker a tile. Two stripe
+ * buffers take turns: while a writer thread streams one stripe to the
+ * file, the workers fill the next one. Tiles are taken from one queue
+ * in order; a worker that gets ahead of the writer by two stripes waits
+ * for a buffer, and the worker finishing the last tile of a stripe
+ * hands it to the writer. The budget also pays for the tile each worker
+ * computes into before narrowing it to bytes.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "../helpers/mandel-lib.h"
+#include "render.h"
+#include "tune.h"
+
+/* The same part of the plane as mandel */
+#define XMIN	-1.8
+#define XMAX	1.0
+#define YMIN	-1.0
+#define YMAX	1.0
+
+#define NBUF	2		/* stripe buffers: one written, one filled */
+#define BAND_H	16		/* rows of a tile, at most */
+
+struct stripe_buf {
+	unsigned char *pixels;	/* rows of width bytes */
+	int remaining;		/* tiles of its stripe not computed yet */
+	int ready;		/* all computed, for the writer */
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t filled;	/* a stripe is ready */
+	pthread_cond_t freed;	/* a stripe was written */
+	struct stripe_buf buf[NBUF];
+	struct tile_grid grid;	/* tiles of tile_w x BAND_H, or fewer, rows */
+	int stripe_h;		/* rows of a stripe, a multiple of grid.tile_h */
+	int nstripes;
+	struct viewport vp;
+	int next;		/* next tile in the queue */
+	int written;		/* stripes written */
+	int fd;
+	double compute_wait, write_wait;	/* seconds stalled on each other */
+} huge = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.filled = PTHREAD_COND_INITIALIZER,
+	.freed = PTHREAD_COND_INITIALIZER,
+};
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-M MB] [-w tile_w] [-i iterations] [-T threads] "
+		"WIDTHxHEIGHT output\n\n"
+		"  WIDTHxHEIGHT: size of the image, e.g. 100000x100000.\n"
+		"  output:       the PGM file to write, `-' for stdout.\n"
+		"  -M MB:        memory for stripe buffers and tiles. Default: 64.\n"
+		"  -w tile_w:    width of the tiles a stripe is cut into. Default: 256.\n"
+		"  -i iterations: iteration cap. Default: %d.\n"
+		"  -T threads:   worker threads. Default: one per online CPU.\n",
+		argv0, MANDEL_MAX_ITERATION);
+	exit(1);
+}
+
+/* Tiles in stripe s, the last one maybe shorter */
+static int stripe_tiles(int s)
+{
+	int rows = huge.grid.height - s * huge.stripe_h;
+
+	if (rows > huge.stripe_h)
+		rows = huge.stripe_h;
+	return huge.grid.tiles_x * ((rows + huge.grid.tile_h - 1) / huge.grid.tile_h);
+}
+
+static void *huge_worker(void *arg)
+{
+	struct stripe_buf *b;
+	struct tile t;
+	unsigned char *row;
+	int *tmp, n, s, i, j;
+	double start;
+
+	tmp = malloc((size_t)huge.grid.tile_w * huge.grid.tile_h * sizeof(*tmp));
+	if (tmp == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	while ((n = __atomic_fetch_add(&huge.next, 1, __ATOMIC_RELAXED)) < huge.grid.ntiles) {
+		tile_get(&huge.grid, n, &t);
+		s = t.y0 / huge.stripe_h;
+		b = &huge.buf[s % NBUF];
+
+		/* its buffer still holds stripe s - NBUF until that is written */
+		pthread_mutex_lock(&huge.lock);
+		if (huge.written < s - NBUF + 1) {
+			start = tune_now();
+			while (huge.written < s - NBUF + 1)
+				pthread_cond_wait(&huge.freed, &huge.lock);
+			huge.compute_wait += tune_now() - start;
+		}
+		pthread_mutex_unlock(&huge.lock);
+
+		compute_mandel_tile(&huge.vp, &t, tmp, t.w);
+		for (j = 0; j < t.h; j++) {
+			row = b->pixels + (size_t)(t.y0 - s * huge.stripe_h + j) * huge.grid.width;
+			for (i = 0; i < t.w; i++)
+				row[t.x0 + i] = tmp[j * t.w + i];
+		}
+
+		if (__atomic_sub_fetch(&b->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+			pthread_mutex_lock(&huge.lock);
+			b->ready = 1;
+			pthread_cond_signal(&huge.filled);
+			pthread_mutex_unlock(&huge.lock);
+		}
+	}
+	free(tmp);
+	return NULL;
+}
+
+static void *huge_writer(void *arg)
+{
+	struct stripe_buf *b;
+	size_t len;
+	int s, rows;
+	double start;
+
+	for (s = 0; s < huge.nstripes; s++) {
+		b = &huge.buf[s % NBUF];
+		pthread_mutex_lock(&huge.lock);
+		start = tune_now();
+		while (!b->ready)
+			pthread_cond_wait(&huge.filled, &huge.lock);
+		huge.write_wait += tune_now() - start;
+		pthread_mutex_unlock(&huge.lock);
+
+		rows = huge.grid.height - s * huge.stripe_h;
+		if (rows > huge.stripe_h)
+			rows = huge.stripe_h;
+		len = (size_t)rows * huge.grid.width;
+		if (insist_write(huge.fd, (char *)b->pixels, len) != (ssize_t)len) {
+			perror("write");
+			exit(1);
+		}
+
+		pthread_mutex_lock(&huge.lock);
+		b->ready = 0;
+		if (s + NBUF < huge.nstripes)
+			b->remaining = stripe_tiles(s + NBUF);
+		huge.written++;
+		pthread_cond_broadcast(&huge.freed);
+		pthread_mutex_unlock(&huge.lock);
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t *workers, writer;
+	struct rusage ru;
+	size_t budget = 64UL << 20;
+	size_t scratch;
+	int opt, width, height, tile_w = 256, band_h, stripe_h, nthreads, mb, i, ret, n;
+	char header[64];
+	double start, elapsed, pixels;
+
+	huge.vp.max_iter = MANDEL_MAX_ITERATION;
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "M:w:i:T:")) != -1) {
+		switch (opt) {
+		case 'M':
+			if (safe_atoi(optarg, &mb) < 0 || mb <= 0)
+				usage(argv[0]);
+			budget = (size_t)mb << 20;
+			break;
+		case 'w':
+			if (safe_atoi(optarg, &tile_w) < 0 || tile_w <= 0)
+				usage(argv[0]);
+			break;
+		case 'i':
+			if (safe_atoi(optarg, &huge.vp.max_iter) < 0 || huge.vp.max_iter <= 0)
+				usage(argv[0]);
+			break;
+		case 'T':
+			if (safe_atoi(optarg, &nthreads) < 0 || nthreads <= 0)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2 || tile_parse_size(argv[optind], &width, &height) < 0)
+		usage(argv[0]);
+
+	/* the workers' tiles first, then as many rows as fit NBUF times */
+	if (tile_w > width)
+		tile_w = width;
+	band_h = BAND_H < height ? BAND_H : height;
+	scratch = (size_t)nthreads * tile_w * band_h * sizeof(int);
+	stripe_h = budget > scratch ? (budget - scratch) / NBUF / width : 0;
+	if (stripe_h == 0) {
+		fprintf(stderr, "%zu MB does not hold %d rows of %d pixels and %d tiles of %dx%d\n",
+			budget >> 20, NBUF, width, nthreads, tile_w, band_h);
+		exit(1);
+	}
+	/* a tile is in one stripe */
+	if (stripe_h < band_h)
+		band_h = stripe_h;
+	if (stripe_h > height)
+		stripe_h = height;
+	stripe_h -= stripe_h % band_h;
+	tile_grid_init(&huge.grid, width, height, tile_w, band_h, TILE_ORDER_ROWS);
+	huge.stripe_h = stripe_h;
+	huge.nstripes = (height + stripe_h - 1) / stripe_h;
+	huge.vp.xmin = XMIN;
+	huge.vp.ymax = YMAX;
+	huge.vp.xstep = (XMAX - XMIN) / width;
+	huge.vp.ystep = (YMAX - YMIN) / height;
+
+	if (strcmp(argv[optind + 1], "-") == 0)
+		huge.fd = 1;
+	else if ((huge.fd = open(argv[optind + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror(argv[optind + 1]);
+		exit(1);
+	}
+	n = snprintf(header, sizeof(header), "P5\n%d %d\n255\n", width, height);
+	if (insist_write(huge.fd, header, n) != n) {
+		perror("write");
+		exit(1);
+	}
+
+	for (i = 0; i < NBUF; i++) {
+		huge.buf[i].pixels = malloc((size_t)stripe_h * width);
+		if (huge.buf[i].pixels == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		if (i < huge.nstripes)
+			huge.buf[i].remaining = stripe_tiles(i);
+	}
+	workers = malloc(nthreads * sizeof(*workers));
+	if (workers == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	start = tune_now();
+	ret = pthread_create(&writer, NULL, huge_writer, NULL);
+	for (i = 0; i < nthreads && ret == 0; i++)
+		ret = pthread_create(&workers[i], NULL, huge_worker, NULL);
+	if (ret) {
+		errno = ret;
+		perror("pthread_create");
+		exit(1);
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i], NULL);
+	pthread_join(writer, NULL);
+	elapsed = tune_now() - start;
+
+	if (huge.fd != 1 && close(huge.fd) < 0) {
+		perror(argv[optind + 1]);
+		exit(1);
+	}
+	getrusage(RUSAGE_SELF, &ru);
+	pixels = (double)width * height;
+	fprintf(stderr, "%dx%d: %d stripes of %d rows, %d tiles, %d threads: %.4fs, "
+		"%.2f Mpixels/s\n", width, height, huge.nstripes, stripe_h,
+		huge.grid.ntiles, nthreads, elapsed, pixels / elapsed / 1e6);
+	fprintf(stderr, "buffers and tiles %.1f MB of %zu MB, peak RSS %.1f MB; "
+		"workers waited %.4fs for writes, writes %.4fs for workers\n",
+		((double)NBUF * stripe_h * width + (double)nthreads * tile_w * band_h * sizeof(int)) /
+		(1 << 20), budget >> 20, ru.ru_maxrss / 1024.0,
+		huge.compute_wait, huge.write_wait);
+
+	for (i = 0; i < NBUF; i++)
+		free(huge.buf[i].pixels);
+	free(workers);
+	return 0;
+}
@@ -0,0 +1,322 @@
+/*
+ * mandel-layout.c
+ *
+ * Benchmark frame layouts on the access patterns of algorithms that
+ * read 2D neighbourhoods: edge detection (the 4 neighbours of every
+ * pixel), supersampling (4x4 boxes), a mip pyramid (2x2 boxes, level
+ * after level) and Mariani-Silver subdivision (the borders of ever
+ * smaller squares). Each runs over the same frame stored as rows,
+ * blocked and in Morton order, walking it in storage order, and must
+ * give the same result on all of them.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "render.h"
+#include "layout.h"
+#include "tune.h"
+
+/* The same part of the plane as mandel */
+#define XMIN	-1.8
+#define XMAX	1.0
+#define YMIN	-1.0
+#define YMAX	1.0
+
+#define SUPERSAMPLE	4
+#define SUBDIV_MIN	4	/* squares this small are not split further */
+
+enum { T_FROM, T_TO, T_EDGE, T_SUPER, T_MIP, T_SUBDIV, NTIMES };
+
+static const char *time_names[NTIMES] = {
+	"from rows", "to rows", "edge", "supersample", "mip", "subdivide"
+};
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-b block] [-i iterations] [-r repeat] [-l layouts] WIDTHxHEIGHT\n\n"
+		"  WIDTHxHEIGHT: size of the frame, e.g. 8192x8192.\n"
+		"  -b block:     side of the blocks, a power of two. Default: 16.\n"
+		"  -i iterations: iteration cap of the frame. Default: 256.\n"
+		"  -r repeat:    runs of each benchmark, the best is kept. Default: 3.\n"
+		"  -l layouts:   comma separated, of rows, blocked and morton.\n"
+		"                Default: all three.\n", argv0);
+	exit(1);
+}
+
+static int *alloc_ints(size_t n)
+{
+	int *p = aligned_alloc(sysconf(_SC_PAGE_SIZE),
+			       (n * sizeof(int) + sysconf(_SC_PAGE_SIZE) - 1) /
+			       sysconf(_SC_PAGE_SIZE) * sysconf(_SC_PAGE_SIZE));
+
+	if (p == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+/* The distance between vertically adjacent pixels inside a block */
+static size_t inner_pitch(const struct layout *l)
+{
+	return l->kind == LAYOUT_ROWS ? l->pitch : (size_t)1 << l->shift;
+}
+
+/**************
+ * Benchmarks *
+ **************/
+
+/* Neighbours of a different color, summed over all pixels */
+static unsigned long edge(const struct layout *l, const int *f)
+{
+	size_t n, bp = inner_pitch(l);
+	unsigned long count = 0;
+	const int *p;
+	struct tile t;
+	int i, j, x, y, c;
+
+	for (n = 0; n < l->nblocks; n++) {
+		if (layout_block(l, n, &t) < 0)
+			continue;
+		for (j = 0; j < t.h; j++) {
+			y = t.y0 + j;
+			p = f + layout_offset(l, t.x0, y);
+			for (i = 0; i < t.w; i++, p++) {
+				x = t.x0 + i;
+				c = *p;
+				/* inside the block neighbours are at fixed distances */
+				if (x > 0)
+					count += (i > 0 ? p[-1] : f[layout_offset(l, x - 1, y)]) != c;
+				if (x < l->width - 1)
+					count += (i < t.w - 1 ? p[1] : f[layout_offset(l, x + 1, y)]) != c;
+				if (y > 0)
+					count += (j > 0 ? p[-bp] : f[layout_offset(l, x, y - 1)]) != c;
+				if (y < l->height - 1)
+					count += (j < t.h - 1 ? p[bp] : f[layout_offset(l, x, y + 1)]) != c;
+			}
+		}
+	}
+	return count;
+}
+
+/*
+ * Average k x k boxes of src into dst, which is src shrunk k times,
+ * walking src in storage order. Returns the sum of dst.
+ */
+static unsigned long downsample(const struct layout *ls, const int *src,
+				const struct layout *ld, int *dst, int k)
+{
+	size_t n, bp = inner_pitch(ls);
+	unsigned long sum = 0;
+	const int *p;
+	struct tile t;
+	int x, y, ii, jj, s, whole;
+
+	/* a box is inside one block, or rows are addressed by pitch anyway */
+	whole = ls->kind == LAYOUT_ROWS || (1 << ls->shift) >= k;
+	for (n = 0; n < ls->nblocks; n++) {
+		if (layout_block(ls, n, &t) < 0)
+			continue;
+		for (y = (t.y0 + k - 1) / k * k; y < t.y0 + t.h && y + k <= ls->height; y += k)
+			for (x = (t.x0 + k - 1) / k * k; x < t.x0 + t.w && x + k <= ls->width; x += k) {
+				s = 0;
+				if (whole) {
+					p = src + layout_offset(ls, x, y);
+					for (jj = 0; jj < k; jj++, p += bp)
+						for (ii = 0; ii < k; ii++)
+							s += p[ii];
+				} else {
+					for (jj = 0; jj < k; jj++)
+						for (ii = 0; ii < k; ii++)
+							s += src[layout_offset(ls, x + ii, y + jj)];
+				}
+				s /= k * k;
+				dst[layout_offset(ld, x / k, y / k)] = s;
+				sum += s;
+			}
+	}
+	return sum;
+}
+
+/*
+ * Mariani-Silver: a square whose border is one color is taken to be
+ * filled with it, any other is split in four. Returns the leaves.
+ */
+static unsigned long subdivide(const struct layout *l, const int *f, int x, int y, int size)
+{
+	int i, c, x1, y1, uniform = 1;
+
+	if (x >= l->width || y >= l->height)
+		return 0;
+	x1 = x + size - 1 < l->width ? x + size - 1 : l->width - 1;
+	y1 = y + size - 1 < l->height ? y + size - 1 : l->height - 1;
+	c = f[layout_offset(l, x, y)];
+	for (i = x; i <= x1 && uniform; i++)
+		uniform = f[layout_offset(l, i, y)] == c && f[layout_offset(l, i, y1)] == c;
+	for (i = y; i <= y1 && uniform; i++)
+		uniform = f[layout_offset(l, x, i)] == c && f[layout_offset(l, x1, i)] == c;
+	if (uniform || size <= SUBDIV_MIN)
+		return 1;
+	size /= 2;
+	return subdivide(l, f, x, y, size) + subdivide(l, f, x + size, y, size) +
+	       subdivide(l, f, x, y + size, size) + subdivide(l, f, x + size, y + size, size);
+}
+
+struct results {
+	double t[NTIMES];
+	unsigned long sum[NTIMES];
+};
+
+static void bench(const struct layout *l, const int *rows, int block, int repeat,
+		  struct results *res)
+{
+	struct layout ss, mip[32];
+	int *f, *back, *out, *levels[32];
+	int nlevels, r, k, side;
+	double start, t[NTIMES];
+	unsigned long sum;
+
+	f = alloc_ints(l->size);
+	back = alloc_ints((size_t)l->width * l->height);
+	layout_init(&ss, LAYOUT_ROWS, l->width / SUPERSAMPLE, l->height / SUPERSAMPLE, 0);
+	out = alloc_ints(ss.size + 1);
+	/* the pyramid in the same layout, down to a pixel */
+	mip[0] = *l;
+	levels[0] = f;
+	for (nlevels = 1; mip[nlevels - 1].width > 1 && mip[nlevels - 1].height > 1; nlevels++) {
+		layout_init(&mip[nlevels], l->kind, mip[nlevels - 1].width / 2,
+			    mip[nlevels - 1].height / 2, block);
+		levels[nlevels] = alloc_ints(mip[nlevels].size);
+	}
+	memset(f, 0, l->size * sizeof(int));
+	for (k = 1; k < nlevels; k++)
+		memset(levels[k], 0, mip[k].size * sizeof(int));
+
+	for (k = 0; k < NTIMES; k++)
+		res->t[k] = 1e30;
+	for (r = 0; r < repeat; r++) {
+		start = tune_now();
+		layout_from_rows(l, f, rows, l->width);
+		t[T_FROM] = tune_now() - start;
+
+		start = tune_now();
+		layout_to_rows(l, f, back, l->width);
+		t[T_TO] = tune_now() - start;
+		res->sum[T_FROM] = res->sum[T_TO] =
+			memcmp(back, rows, (size_t)l->width * l->height * sizeof(int)) != 0;
+
+		start = tune_now();
+		res->sum[T_EDGE] = edge(l, f);
+		t[T_EDGE] = tune_now() - start;
+
+		start = tune_now();
+		res->sum[T_SUPER] = downsample(l, f, &ss, out, SUPERSAMPLE);
+		t[T_SUPER] = tune_now() - start;
+
+		start = tune_now();
+		for (sum = 0, k = 1; k < nlevels; k++)
+			sum += downsample(&mip[k - 1], levels[k - 1], &mip[k], levels[k], 2);
+		res->sum[T_MIP] = sum;
+		t[T_MIP] = tune_now() - start;
+
+		for (side = 1; side < l->width || side < l->height; side *= 2)
+			;
+		start = tune_now();
+		res->sum[T_SUBDIV] = subdivide(l, f, 0, 0, side);
+		t[T_SUBDIV] = tune_now() - start;
+
+		for (k = 0; k < NTIMES; k++)
+			if (t[k] < res->t[k])
+				res->t[k] = t[k];
+	}
+
+	for (k = 1; k < nlevels; k++)
+		free(levels[k]);
+	free(out);
+	free(back);
+	free(f);
+}
+
+int main(int argc, char *argv[])
+{
+	enum layout_kind kinds[3] = { LAYOUT_ROWS, LAYOUT_BLOCKED, LAYOUT_MORTON };
+	struct results res[3];
+	struct layout rows, l[3];
+	struct viewport vp;
+	int opt, width, height, block = 16, repeat = 3, nkinds = 3, i, k;
+	char *s, *tok;
+	double start;
+	int *frame;
+
+	vp.max_iter = 256;
+	while ((opt = getopt(argc, argv, "b:i:r:l:")) != -1) {
+		switch (opt) {
+		case 'b':
+			if (safe_atoi(optarg, &block) < 0)
+				usage(argv[0]);
+			break;
+		case 'i':
+			if (safe_atoi(optarg, &vp.max_iter) < 0 || vp.max_iter <= 0)
+				usage(argv[0]);
+			break;
+		case 'r':
+			if (safe_atoi(optarg, &repeat) < 0 || repeat <= 0)
+				usage(argv[0]);
+			break;
+		case 'l':
+			nkinds = 0;
+			for (s = optarg; (tok = strtok(s, ",")) != NULL; s = NULL)
+				if (nkinds == 3 || layout_parse(tok, &kinds[nkinds++]) < 0)
+					usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 1 || tile_parse_size(argv[optind], &width, &height) < 0)
+		usage(argv[0]);
+	for (i = 0; i < nkinds; i++)
+		if (layout_init(&l[i], kinds[i], width, height, block) < 0) {
+			fprintf(stderr, "`%d' is not valid for `block' at %dx%d\n", block, width, height);
+			exit(1);
+		}
+
+	vp.xmin = XMIN;
+	vp.ymax = YMAX;
+	vp.xstep = (XMAX - XMIN) / width;
+	vp.ystep = (YMAX - YMIN) / height;
+	layout_init(&rows, LAYOUT_ROWS, width, height, 0);
+	frame = alloc_ints(rows.size);
+	start = tune_now();
+	layout_render(&rows, &vp, frame);
+	fprintf(stderr, "%dx%d, %d iterations: rendered in %.4fs, %.1f MB per layout\n",
+		width, height, vp.max_iter, tune_now() - start,
+		rows.size * sizeof(int) / 1048576.0);
+
+	for (i = 0; i < nkinds; i++)
+		bench(&l[i], frame, block, repeat, &res[i]);
+
+	printf("%-12s", "ms");
+	for (i = 0; i < nkinds; i++)
+		printf(" %12s", layout_name(kinds[i]));
+	printf("\n");
+	for (k = 0; k < NTIMES; k++) {
+		printf("%-12s", time_names[k]);
+		for (i = 0; i < nkinds; i++)
+			printf(" %12.2f", res[i].t[k] * 1e3);
+		/* every layout must agree with the first */
+		for (i = 1; i < nkinds; i++)
+			if (res[i].sum[k] != res[0].sum[k])
+				break;
+		printf("%s\n", i < nkinds || (k <= T_TO && res[0].sum[k]) ? "  MISMATCH" : "");
+	}
+	if (nkinds > 1 && kinds[1] != LAYOUT_ROWS)
+		printf("(blocks of %dx%d)\n", block, block);
+
+	free(frame);
+	return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * mandel-lazy.c
+ *
+ * Map a huge frame lazily and read a crop of it: only the pages the
+ * crop touches are ever computed. Residency before and after is read
+ * from /proc/self/pagemap with the helpers of exercise4/mmap, and the
+ * crop is checked against computing it directly.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../helpers/mandel-lib.h"
+#include "../mmap/help.h"
+#include "render.h"
+#include "lazy.h"
+#include "tune.h"
+
+/* The same part of the plane as mandel */
+#define XMIN	-1.8
+#define XMAX	1.0
+#define YMIN	-1.0
+#define YMAX	1.0
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-c x,y,WxH] [-q] WIDTHxHEIGHT\n\n"
+		"  WIDTHxHEIGHT: size of the (lazy) frame, e.g. 100000x60000.\n"
+		"  -c x,y,WxH:   crop to read. Default: 90x50 at the center.\n"
+		"  -q:           don't print the crop, only the statistics.\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct lazy_frame lf;
+	struct viewport vp;
+	struct tile crop;
+	uint64_t before, after;
+	int opt, quiet = 0, have_crop = 0, width, height, row, i, mismatch = 0;
+	unsigned long sum = 0;
+	int *check;
+	double start, elapsed;
+	char *p;
+
+	memset(&crop, 0, sizeof(crop));
+	while ((opt = getopt(argc, argv, "c:q")) != -1) {
+		switch (opt) {
+		case 'c':
+			if (sscanf(optarg, "%d,%d,", &crop.x0, &crop.y0) != 2 ||
+			    (p = strrchr(optarg, ',')) == NULL ||
+			    tile_parse_size(p + 1, &crop.w, &crop.h) < 0)
+				usage(argv[0]);
+			have_crop = 1;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 1 || tile_parse_size(argv[optind], &width, &height) < 0)
+		usage(argv[0]);
+	if (!have_crop) {
+		crop.w = width < 90 ? width : 90;
+		crop.h = height < 50 ? height : 50;
+		crop.x0 = (width - crop.w) / 2;
+		crop.y0 = (height - crop.h) / 2;
+	}
+	if (crop.x0 < 0 || crop.y0 < 0 || crop.x0 + crop.w > width || crop.y0 + crop.h > height) {
+		fprintf(stderr, "crop does not fit in the frame\n");
+		exit(1);
+	}
+
+	vp.xmin = XMIN;
+	vp.ymax = YMAX;
+	vp.xstep = (XMAX - XMIN) / width;
+	vp.ystep = (YMAX - YMIN) / height;
+	vp.max_iter = MANDEL_MAX_ITERATION;
+	if (lazy_frame_create(&lf, width, height, &vp) < 0)
+		exit(1);
+	before = count_resident_pages(lf.frame.base, lf.frame.mapped);
+
+	/* the consumer: read the crop row by row, faulting pages in */
+	start = tune_now();
+	for (row = crop.y0; row < crop.y0 + crop.h; row++) {
+		if (!quiet)
+			output_mandel_line(1, frame_row(&lf.frame, row) + crop.x0, crop.w);
+		else
+			for (i = 0; i < crop.w; i++)
+				sum += frame_row(&lf.frame, row)[crop.x0 + i];
+	}
+	elapsed = tune_now() - start;
+	after = count_resident_pages(lf.frame.base, lf.frame.mapped);
+	if (!quiet)
+		reset_xterm_color(1);
+
+	/* the same crop, computed directly */
+	check = malloc((size_t)crop.w * crop.h * sizeof(*check));
+	if (check == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	compute_mandel_tile(&vp, &crop, check, crop.w);
+	for (row = 0; row < crop.h; row++)
+		mismatch += memcmp(check + row * crop.w, frame_row(&lf.frame, crop.y0 + row) + crop.x0,
+				   crop.w * sizeof(int)) != 0;
+
+	fprintf(stderr, "frame %dx%d: %zu MB mapped, %lu pages\n", width, height,
+		lf.frame.mapped >> 20, (unsigned long)(lf.frame.mapped / get_page_size()));
+	fprintf(stderr, "crop %dx%d at %d,%d: %.4fs, %lu pages computed (%.4fs), "
+		"resident %llu -> %llu pages (%.4f%% of the frame)\n",
+		crop.w, crop.h, crop.x0, crop.y0, elapsed, lf.pages, lf.compute_time,
+		(unsigned long long)before, (unsigned long long)after,
+		100.0 * after * get_page_size() / lf.frame.mapped);
+	fprintf(stderr, "crop %s the directly computed one", mismatch ? "DIFFERS from" : "is identical to");
+	if (quiet)
+		fprintf(stderr, " (sum of colors %lu)", sum);
+	fputc('\n', stderr);
+
+	free(check);
+	lazy_frame_destroy(&lf);
+	return mismatch ? 1 : 0;
+}
@@ -0,0 +1,530 @@
+/*
+ * mandel-tiled.c
+ *
+ * A tile server: serves tiles of the Mandelbrot set, addressed as
+ * /z/x/y like map tiles, over HTTP on a Unix-domain socket or TCP.
+ *
+ *   GET /z/x/y[?iter=N]  the tile as a PGM image of xterm color values
+ *   GET /stats           counters and p50 / p99 latency
+ *
+ * At zoom z the square x in [-2.5, 1.5], y in [-2, 2] is split into
+ * 2^z x 2^z tiles. Connections are handled by a pool of threads.
+ * Computed tiles are kept in an in-memory LRU cache bounded in bytes;
+ * concurrent requests for a tile that is being computed wait for it
+ * instead of computing it again.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "render.h"
+#include "farm.h"
+#include "tune.h"
+
+#define WORLD_XMIN	-2.5
+#define WORLD_YMAX	2.0
+#define WORLD_SIZE	4.0
+#define MAX_ZOOM	40
+#define HASH_SIZE	4096
+#define CONN_QUEUE	256
+#define LAT_SAMPLES	4096		/* latency percentiles over the last requests */
+#define REQLEN		2048
+#define IO_TIMEOUT	10		/* seconds a client may stall a worker */
+#define ACCEPT_BACKOFF_MS 100		/* out of descriptors or buffers */
+
+struct tile_key {
+	uint64_t x, y;
+	uint32_t z, size, iter;
+};
+
+struct tile_entry {
+	struct tile_key key;
+	unsigned char *pixels;		/* NULL while being computed */
+	size_t bytes;
+	struct tile_entry *hnext;	/* hash chain */
+	struct tile_entry *prev, *next;	/* LRU list, once computed */
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t done;		/* some tile was computed */
+	struct tile_entry *hash[HASH_SIZE];
+	struct tile_entry *head, *tail;	/* most recently used first */
+	size_t bytes, max_bytes;
+	unsigned long entries;
+	unsigned long requests, hits, misses, coalesced, evictions, errors;
+	double lat[LAT_SAMPLES];	/* seconds, a ring */
+	unsigned long nlat;
+} cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int fd[CONN_QUEUE];
+	double start[CONN_QUEUE];
+	int head, count;
+} conns = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int tile_size = 256;
+static int default_iter = 1000;
+static volatile sig_atomic_t quit;
+
+/*********
+ * Cache *
+ *********/
+
+static unsigned int hash_key(const struct tile_key *k)
+{
+	uint64_t h = k->x * 0x9e3779b97f4a7c15ULL ^ k->y * 0xc2b2ae3d27d4eb4fULL ^
+		     ((uint64_t)k->z << 40 | (uint64_t)k->iter << 8 | k->size);
+
+	return (h ^ h >> 29) % HASH_SIZE;
+}
+
+static int key_equal(const struct tile_key *a, const struct tile_key *b)
+{
+	return a->x == b->x && a->y == b->y && a->z == b->z &&
+	       a->size == b->size && a->iter == b->iter;
+}
+
+static struct tile_entry *lookup(const struct tile_key *k)
+{
+	struct tile_entry *e;
+
+	for (e = cache.hash[hash_key(k)]; e; e = e->hnext)
+		if (key_equal(&e->key, k))
+			return e;
+	return NULL;
+}
+
+static void lru_unlink(struct tile_entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		cache.head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		cache.tail = e->prev;
+}
+
+static void lru_push(struct tile_entry *e)
+{
+	e->prev = NULL;
+	e->next = cache.head;
+	if (cache.head)
+		cache.head->prev = e;
+	else
+		cache.tail = e;
+	cache.head = e;
+}
+
+static void remove_entry(struct tile_entry *e)
+{
+	struct tile_entry **p;
+
+	for (p = &cache.hash[hash_key(&e->key)]; *p != e; p = &(*p)->hnext)
+		;
+	*p = e->hnext;
+	if (e->pixels) {
+		lru_unlink(e);
+		cache.bytes -= e->bytes;
+		cache.entries--;
+	}
+	free(e->pixels);
+	free(e);
+}
+
+/* Compute a tile into a new buffer of size * size color values */
+static unsigned char *compute_tile(const struct tile_key *k)
+{
+	double side = WORLD_SIZE / (double)(1ULL << k->z);
+	struct viewport vp;
+	struct tile t = { 0 };
+	unsigned char *pixels;
+	int *tmp;
+	size_t i, n = (size_t)k->size * k->size;
+
+	vp.xmin = WORLD_XMIN + k->x * side;
+	vp.ymax = WORLD_YMAX - k->y * side;
+	vp.xstep = vp.ystep = side / k->size;
+	vp.max_iter = k->iter;
+	t.w = t.h = k->size;
+
+	tmp = malloc(n * sizeof(*tmp));
+	pixels = malloc(n);
+	if (tmp == NULL || pixels == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	compute_mandel_tile(&vp, &t, tmp, k->size);
+	for (i = 0; i < n; i++)
+		pixels[i] = tmp[i];
+	free(tmp);
+	return pixels;
+}
+
+/*
+ * Return a copy of the tile's pixels: from the cache, from whoever is
+ * computing it already, or computed here and added to the cache.
+ */
+static unsigned char *get_tile(const struct tile_key *k)
+{
+	struct tile_entry *e;
+	unsigned char *pixels, *copy;
+	size_t bytes = (size_t)k->size * k->size;
+	int waited = 0;
+
+	copy = malloc(bytes);
+	if (copy == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	pthread_mutex_lock(&cache.lock);
+	/* look again after every wake-up: the entry may have been evicted */
+	while ((e = lookup(k)) != NULL && e->pixels == NULL) {
+		waited = 1;
+		pthread_cond_wait(&cache.done, &cache.lock);
+	}
+	if (e) {
+		memcpy(copy, e->pixels, bytes);
+		lru_unlink(e);
+		lru_push(e);
+		if (waited)
+			cache.coalesced++;
+		else
+			cache.hits++;
+		pthread_mutex_unlock(&cache.lock);
+		return copy;
+	}
+
+	/* ours to compute: a placeholder makes later requests wait for it */
+	cache.misses++;
+	e = calloc(1, sizeof(*e));
+	if (e == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	e->key = *k;
+	e->hnext = cache.hash[hash_key(k)];
+	cache.hash[hash_key(k)] = e;
+	pthread_mutex_unlock(&cache.lock);
+
+	pixels = compute_tile(k);
+	memcpy(copy, pixels, bytes);
+
+	pthread_mutex_lock(&cache.lock);
+	if (bytes > cache.max_bytes) {
+		/* would never fit: don't cache, just release the waiters */
+		free(pixels);
+		remove_entry(e);
+	} else {
+		while (cache.bytes + bytes > cache.max_bytes) {
+			remove_entry(cache.tail);
+			cache.evictions++;
+		}
+		e->pixels = pixels;
+		e->bytes = bytes;
+		cache.bytes += bytes;
+		cache.entries++;
+		lru_push(e);
+	}
+	pthread_cond_broadcast(&cache.done);
+	pthread_mutex_unlock(&cache.lock);
+	return copy;
+}
+
+/**************
+ * Statistics *
+ **************/
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void record_latency(double seconds, int error)
+{
+	pthread_mutex_lock(&cache.lock);
+	cache.requests++;
+	cache.errors += error;
+	cache.lat[cache.nlat++ % LAT_SAMPLES] = seconds;
+	pthread_mutex_unlock(&cache.lock);
+}
+
+static int format_stats(char *buf, size_t len)
+{
+	double lat[LAT_SAMPLES], p50 = 0, p99 = 0;
+	unsigned long n;
+	int ret;
+
+	pthread_mutex_lock(&cache.lock);
+	n = cache.nlat < LAT_SAMPLES ? cache.nlat : LAT_SAMPLES;
+	memcpy(lat, cache.lat, n * sizeof(*lat));
+	ret = snprintf(buf, len,
+		       "requests %lu\nerrors %lu\nhits %lu\nmisses %lu\ncoalesced %lu\n"
+		       "evictions %lu\ntiles %lu\nbytes %zu\nmax_bytes %zu\n",
+		       cache.requests, cache.errors, cache.hits, cache.misses, cache.coalesced,
+		       cache.evictions, cache.entries, cache.bytes, cache.max_bytes);
+	pthread_mutex_unlock(&cache.lock);
+
+	if (n > 0) {
+		qsort(lat, n, sizeof(*lat), cmp_double);
+		p50 = lat[(n - 1) * 50 / 100];
+		p99 = lat[(n - 1) * 99 / 100];
+	}
+	ret += snprintf(buf + ret, len - ret, "p50_ms %.3f\np99_ms %.3f\nsamples %lu\n",
+			p50 * 1e3, p99 * 1e3, n);
+	return ret;
+}
+
+/********
+ * HTTP *
+ ********/
+
+static void respond(int fd, const char *status, const char *type,
+		    const void *hdr, size_t hlen, const void *body, size_t blen)
+{
+	char head[256];
+	int n;
+
+	n = snprintf(head, sizeof(head),
+		     "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+		     "Connection: close\r\n\r\n", status, type, hlen + blen);
+	if (farm_write(fd, head, n) == 0 && farm_write(fd, hdr, hlen) == 0)
+		farm_write(fd, body, blen);
+}
+
+static void error_response(int fd, const char *status)
+{
+	char body[64];
+
+	snprintf(body, sizeof(body), "%s\n", status);
+	respond(fd, status, "text/plain", "", 0, body, strlen(body));
+}
+
+/* Read the request head; only its first line matters */
+static int read_request(int fd, char *buf, size_t len)
+{
+	size_t n = 0;
+	ssize_t ret;
+
+	while (n < len - 1) {
+		ret = read(fd, buf + n, len - 1 - n);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		n += ret;
+		buf[n] = '\0';
+		if (strstr(buf, "\r\n\r\n") || strstr(buf, "\n\n"))
+			return 0;
+	}
+	return -1;
+}
+
+/* Serve one request; returns 0, or -1 if it was an error */
+static int serve(int fd)
+{
+	char req[REQLEN], path[REQLEN], hdr[64], stats[1024];
+	struct tile_key k;
+	unsigned int z, iter;
+	unsigned long long x, y;
+	unsigned char *pixels;
+	char *q;
+	int n;
+
+	if (read_request(fd, req, sizeof(req)) < 0)
+		return -1;
+	if (sscanf(req, "GET %2047s HTTP/", path) != 1) {
+		error_response(fd, "400 Bad Request");
+		return -1;
+	}
+	if (strcmp(path, "/stats") == 0) {
+		n = format_stats(stats, sizeof(stats));
+		respond(fd, "200 OK", "text/plain", "", 0, stats, n);
+		return 0;
+	}
+
+	iter = default_iter;
+	if ((q = strchr(path, '?')) != NULL) {
+		*q++ = '\0';
+		if (sscanf(q, "iter=%u", &iter) != 1 || iter == 0 || iter > MANDEL_MAX_ITERATION) {
+			error_response(fd, "400 Bad Request");
+			return -1;
+		}
+	}
+	if (sscanf(path, "/%u/%llu/%llu%n", &z, &x, &y, &n) != 3 || path[n] != '\0') {
+		error_response(fd, "404 Not Found");
+		return -1;
+	}
+	if (z > MAX_ZOOM || x >= (1ULL << z) || y >= (1ULL << z)) {
+		error_response(fd, "404 Not Found");
+		return -1;
+	}
+
+	k.z = z;
+	k.x = x;
+	k.y = y;
+	k.size = tile_size;
+	k.iter = iter;
+	pixels = get_tile(&k);
+	n = snprintf(hdr, sizeof(hdr), "P5\n%d %d\n255\n", tile_size, tile_size);
+	respond(fd, "200 OK", "image/x-portable-graymap", hdr, n,
+		pixels, (size_t)tile_size * tile_size);
+	free(pixels);
+	return 0;
+}
+
+static void *worker(void *arg)
+{
+	double start;
+	int fd, ret;
+
+	for (;;) {
+		pthread_mutex_lock(&conns.lock);
+		while (conns.count == 0)
+			pthread_cond_wait(&conns.cond, &conns.lock);
+		fd = conns.fd[conns.head];
+		start = conns.start[conns.head];
+		conns.head = (conns.head + 1) % CONN_QUEUE;
+		conns.count--;
+		pthread_cond_broadcast(&conns.cond);
+		pthread_mutex_unlock(&conns.lock);
+
+		ret = serve(fd);
+		close(fd);
+		record_latency(tune_now() - start, ret < 0);
+	}
+	return NULL;
+}
+
+static void sigint_handler(int signum)
+{
+	quit = 1;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-s size] [-i iter] [-t threads] [-M MB] address\n\n"
+		"  address:    unix:/path or host:port, e.g. 127.0.0.1:8080\n"
+		"  -s size:    tile width and height in pixels. Default: 256.\n"
+		"  -i iter:    default iteration cap, ?iter=N overrides it. Default: 1000.\n"
+		"  -t threads: worker threads. Default: the number of CPUs.\n"
+		"  -M MB:      memory for cached tiles. Default: 64.\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct timeval timeout = { .tv_sec = IO_TIMEOUT };
+	struct sigaction sa;
+	pthread_t tid;
+	char stats[1024];
+	int opt, nthreads, mb, lfd, fd, i, ret;
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	cache.max_bytes = 64UL << 20;
+	while ((opt = getopt(argc, argv, "s:i:t:M:")) != -1) {
+		switch (opt) {
+		case 's':
+			if (safe_atoi(optarg, &tile_size) < 0)
+				usage(argv[0]);
+			break;
+		case 'i':
+			if (safe_atoi(optarg, &default_iter) < 0)
+				usage(argv[0]);
+			break;
+		case 't':
+			if (safe_atoi(optarg, &nthreads) < 0)
+				usage(argv[0]);
+			break;
+		case 'M':
+			if (safe_atoi(optarg, &mb) < 0 || mb <= 0)
+				usage(argv[0]);
+			cache.max_bytes = (size_t)mb << 20;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 1 || tile_size <= 0 || tile_size > 4096 || nthreads <= 0 ||
+	    default_iter <= 0 || default_iter > MANDEL_MAX_ITERATION)
+		usage(argv[0]);
+
+	/* no SA_RESTART: accept() returns, and we print the stats and leave */
+	sa.sa_handler = sigint_handler;
+	sa.sa_flags = 0;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if ((lfd = farm_listen(argv[optind])) < 0)
+		exit(1);
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_create(&tid, NULL, worker, NULL);
+		if (ret) {
+			errno = ret;
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	fprintf(stderr, "%s: serving %dx%d tiles at %s with %d threads\n",
+		argv[0], tile_size, tile_size, argv[optind], nthreads);
+
+	while (!quit) {
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			/* these last until connections close: wait rather than spin */
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+				poll(NULL, 0, ACCEPT_BACKOFF_MS);
+			continue;
+		}
+		/* a client that sends or reads nothing must not hold a worker */
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0 ||
+		    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
+			perror("setsockopt");
+			close(fd);
+			continue;
+		}
+		pthread_mutex_lock(&conns.lock);
+		while (conns.count == CONN_QUEUE)
+			pthread_cond_wait(&conns.cond, &conns.lock);
+		i = (conns.head + conns.count) % CONN_QUEUE;
+		conns.fd[i] = fd;
+		conns.start[i] = tune_now();
+		conns.count++;
+		pthread_cond_broadcast(&conns.cond);
+		pthread_mutex_unlock(&conns.lock);
+	}
+
+	format_stats(stats, sizeof(stats));
+	fputs(stats, stderr);
+	if (strncmp(argv[optind], "unix:", 5) == 0)
+		unlink(argv[optind] + 5);
+	return 0;
+}
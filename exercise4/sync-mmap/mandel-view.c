@@ -0,0 +1,119 @@
+/*
+ * mandel-view.c
+ *
+ * A viewer for frames published by `mandel -P': maps the frame and
+ * prints every row as soon as the renderer flags it done, without
+ * going through the renderer's output.
+ *
+ * The first frame shown is the one being drawn or, if none is, the
+ * last one completed; every later one is a new frame. The frame goes
+ * away when mandel exits, so for watching frames as they are drawn run
+ * it with -n, or keep the object alive some other way: a viewer started
+ * after a single frame is done sees it only if mandel is still running.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../helpers/mandel-lib.h"
+#include "render.h"
+#include "workq.h"
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-n frames] path\n\n"
+		"  path:      /proc/<pid>/fd/<fd> printed by `mandel -P memfd', or\n"
+		"             /dev/shm/<name> for `mandel -P /<name>'.\n"
+		"  -n frames: frames to show, the current one first. Default: 1.\n"
+		"Publish with `mandel -n' to watch more than one frame.\n", argv0);
+	exit(1);
+}
+
+/* Frame n is drawn at seq 2n + 1 and complete at 2n + 2 */
+static unsigned int frame_number(unsigned int seq)
+{
+	return ((seq & 1) ? seq : seq - 1) / 2;
+}
+
+static int row_ready(const struct frame_header *h, int row)
+{
+	return (__atomic_load_n(&h->ready[row / 64], __ATOMIC_ACQUIRE) >> (row % 64)) & 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct frame_header *h;
+	unsigned int seq, last = 0, rows, next;
+	size_t len;
+	int opt, nframes = 1, n, row;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			if (safe_atoi(optarg, &nframes) < 0 || nframes <= 0)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 1)
+		usage(argv[0]);
+	if ((h = frame_attach(argv[optind], &len)) == NULL)
+		exit(1);
+
+	for (n = 0; n < nframes; n++) {
+		/*
+		 * The frame being drawn, or the next one; on attach, the last
+		 * complete one will do too.
+		 */
+		for (;;) {
+			rows = __atomic_load_n(&h->rows, __ATOMIC_SEQ_CST);
+			seq = __atomic_load_n(&h->seq, __ATOMIC_SEQ_CST);
+			if (seq != last && ((seq & 1) || (n == 0 && seq != 0)))
+				break;
+			/* until more rows are flagged, or a frame starts */
+			futex_wait(&h->rows, rows);
+		}
+		last = seq;
+		/* a drawn frame stays until the next begins */
+		next = (seq & 1) ? seq + 1 : seq;
+
+		for (row = 0; row < (int)h->height; ) {
+			rows = __atomic_load_n(&h->rows, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&h->seq, __ATOMIC_SEQ_CST) != seq &&
+			    __atomic_load_n(&h->seq, __ATOMIC_SEQ_CST) != next) {
+				/* overtaken by the next frame */
+				fprintf(stderr, "%s: frame %u dropped\n", argv[0], frame_number(seq));
+				break;
+			}
+			if (!row_ready(h, row)) {
+				futex_wait(&h->rows, rows);
+				continue;
+			}
+			output_mandel_line(1, (const int *)((const char *)h + h->data) + row * h->pitch,
+					   h->width);
+			row++;
+		}
+		if (row < (int)h->height)
+			continue;
+
+		/* the partial mark is final once the frame is */
+		for (;;) {
+			rows = __atomic_load_n(&h->rows, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&h->seq, __ATOMIC_SEQ_CST) != seq || !(seq & 1))
+				break;
+			futex_wait(&h->rows, rows);
+		}
+		if (__atomic_load_n(&h->partial, __ATOMIC_SEQ_CST))
+			fprintf(stderr, "%s: frame %u is partial, %u tiles approximated\n",
+				argv[0], frame_number(seq), h->partial);
+	}
+
+	reset_xterm_color(1);
+	munmap(h, len);
+	return 0;
+}
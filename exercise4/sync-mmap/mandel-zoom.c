@@ -0,0 +1,584 @@
+/*
+ * mandel-zoom.c
+ *
+ * Render a zoom from one viewport to another as a video: raw YUV4MPEG2
+ * (4:2:0, for ffmpeg, mpv and friends) or a stream of binary PPMs, to
+ * stdout or a file.
+ *
+ * All frames are scaled about the point both viewports share, which
+ * sits on the same pixel (ip, jp) of every frame. When the zoom takes a
+ * whole number m of frames per octave (or -s rounds it to one), the
+ * pixel steps of frames k and k - m differ by a factor of exactly 2, so
+ * every other sample of one is bit for bit a sample of the other: a
+ * quarter of each frame is copied from m frames back instead of
+ * computed. Only those samples of the last m frames are kept, the
+ * middle quarter of each zooming in and every other pixel of every
+ * other row zooming out, and only if they fit in the -M budget.
+ *
+ * Frames are pipelined: while a writer thread converts frame k to YUV
+ * or RGB and writes it, the workers compute frame k + 1.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../helpers/mandel-lib.h"
+#include "render.h"
+#include "tune.h"
+
+#define MAX_MISS	0.25	/* octaves -s may put the last frame off by */
+#define EXACT_MISS	1e-9	/* octaves that are not worth mentioning */
+
+enum video_format { FORMAT_Y4M, FORMAT_PPM };
+
+static struct {
+	int width, height;
+	int nframes;
+	int max_iter;
+	int nthreads;
+	int m;			/* frames per octave, 0 for an exact path */
+	int dir;		/* 1 zooming in, -1 zooming out */
+	int reuse;
+	double px, py;		/* the point every frame is scaled about */
+	int ip, jp;		/* its pixel */
+	double xstep, ystep;	/* of frame 0 */
+	double ratio;		/* of the last frame's step to the first's */
+	int snap;		/* round to whole frames per octave */
+	unsigned char *frames[2];	/* xterm color values, frame k in slot k % 2 */
+	/*
+	 * The samples frame k + m takes from frame k, in keep[k % m]: the
+	 * one at offset (e, f) from (ip, jp) zooming in, (2e, 2f) zooming
+	 * out, for e0 <= e <= e1 and f0 <= f <= f1.
+	 */
+	unsigned char **keep;
+	int e0, e1, f0, f1;
+	size_t budget;		/* bytes keep may take */
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int computed, written;	/* frames */
+	int cur;		/* frame being computed */
+	int next_row;
+	unsigned long reused, samples;
+	double compute_wait, write_wait, encode_time;
+
+	enum video_format format;
+	int fps;
+	int fd;
+} zoom = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-f format] [-o output] [-r fps] [-i iterations] [-T threads]\n"
+		"          [-M MB] [-s] [-R]\n"
+		"          WIDTHxHEIGHT frames from to\n\n"
+		"  from, to:     viewports as xmin,xmax,ymin,ymax. The frames keep\n"
+		"                the aspect of `from'; `to' gives the zoom and where.\n"
+		"  -f format:    y4m or ppm. Default: y4m.\n"
+		"  -o output:    file to write. Default: stdout.\n"
+		"  -r fps:       frame rate recorded in a y4m stream. Default: 30.\n"
+		"  -i iterations: iteration cap. Default: 256.\n"
+		"  -T threads:   worker threads. Default: one per online CPU.\n"
+		"  -M MB:        memory for the samples kept for reuse; if they\n"
+		"                need more, every pixel is computed. Default: 256.\n"
+		"  -s:           round the zoom to whole frames per octave, so that\n"
+		"                samples can be reused, even though the last frame\n"
+		"                then misses `to' by up to %g octaves.\n"
+		"  -R:           compute every pixel, reusing none.\n", argv0, MAX_MISS);
+	exit(1);
+}
+
+/**********
+ * Frames *
+ **********/
+
+/* The pixel steps of frame k */
+static void frame_steps(int k, double *xstep, double *ystep)
+{
+	double f;
+
+	if (zoom.m == 0) {
+		f = pow(zoom.ratio, zoom.nframes > 1 ? (double)k / (zoom.nframes - 1) : 0);
+		*xstep = zoom.xstep * f;
+		*ystep = zoom.ystep * f;
+		return;
+	}
+	/* the octave with ldexp(): exact, so frame k + m is exactly twice as fine */
+	f = pow(2, -zoom.dir * (double)(k % zoom.m) / zoom.m);
+	*xstep = ldexp(zoom.xstep * f, -zoom.dir * (k / zoom.m));
+	*ystep = ldexp(zoom.ystep * f, -zoom.dir * (k / zoom.m));
+}
+
+/*
+ * The offset from (ip, jp) at which frame k + m finds a kept sample of
+ * frame k at offset d, or 1 << 30 if none: d / 2 zooming in, 2d out.
+ */
+static int kept_offset(int d)
+{
+	if (zoom.dir > 0)
+		return d % 2 == 0 ? d / 2 : 1 << 30;
+	return d;
+}
+
+static void compute_row(int k, int j, unsigned char *dst)
+{
+	const unsigned char *prev = NULL;
+	double xstep, ystep, y;
+	unsigned long reused = 0;
+	int i, d, e, f, dj = j - zoom.jp;
+
+	frame_steps(k, &xstep, &ystep);
+	y = zoom.py - dj * ystep;
+
+	/* the kept row of frame k - m on which samples of this one lie, if any */
+	if (zoom.keep && k >= zoom.m) {
+		f = kept_offset(dj);
+		if (f >= zoom.f0 && f <= zoom.f1)
+			prev = zoom.keep[k % zoom.m] + (size_t)(f - zoom.f0) * (zoom.e1 - zoom.e0 + 1);
+	}
+
+	for (i = 0; i < zoom.width; i++) {
+		d = i - zoom.ip;
+		if (prev) {
+			e = kept_offset(d);
+			if (e >= zoom.e0 && e <= zoom.e1) {
+				dst[i] = prev[e - zoom.e0];
+				reused++;
+				continue;
+			}
+		}
+		dst[i] = mandel_color(zoom.px + d * xstep, y, zoom.max_iter);
+	}
+	__atomic_fetch_add(&zoom.reused, reused, __ATOMIC_RELAXED);
+}
+
+/* Keep the samples of frame k that frame k + m will take */
+static void keep_samples(int k, const unsigned char *frame)
+{
+	unsigned char *dst = zoom.keep[k % zoom.m];
+	int e, f, scale = zoom.dir > 0 ? 1 : 2;
+
+	for (f = zoom.f0; f <= zoom.f1; f++) {
+		const unsigned char *row = frame + (size_t)(zoom.jp + scale * f) * zoom.width;
+
+		for (e = zoom.e0; e <= zoom.e1; e++)
+			*dst++ = row[zoom.ip + scale * e];
+	}
+}
+
+static int floor_div(int a, int b)
+{
+	return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+/*
+ * The offsets e of kept samples along an axis of n pixels, the fixed
+ * point at p: a point at offset e in the coarser frame is at 2e in the
+ * finer one, and both are in the frame. Returns the count, maybe 0.
+ */
+static int keep_range(int p, int n, int *e0, int *e1)
+{
+	int lo = -p, hi = n - 1 - p;
+
+	*e0 = -floor_div(p, 2);
+	*e1 = floor_div(hi, 2);
+	if (*e0 < lo)
+		*e0 = lo;
+	if (*e1 > hi)
+		*e1 = hi;
+	return *e1 >= *e0 ? *e1 - *e0 + 1 : 0;
+}
+
+/* Set up keep[], or leave it NULL if there is nothing to reuse */
+static void keep_init(void)
+{
+	size_t size;
+	int i, w, h;
+
+	if (!zoom.reuse || !zoom.m)
+		return;
+	w = keep_range(zoom.ip, zoom.width, &zoom.e0, &zoom.e1);
+	h = keep_range(zoom.jp, zoom.height, &zoom.f0, &zoom.f1);
+	if (w == 0 || h == 0) {
+		fprintf(stderr, "zoom: the fixed point is too far out of the frame to reuse samples\n");
+		return;
+	}
+	size = (size_t)w * h;
+	if (size * zoom.m > zoom.budget) {
+		fprintf(stderr, "zoom: keeping %d frames of %dx%d samples takes %zu MB, more than "
+			"-M %zu: computing every pixel\n", zoom.m, w, h,
+			(size * zoom.m + (1 << 20) - 1) >> 20, zoom.budget >> 20);
+		return;
+	}
+	zoom.keep = malloc(zoom.m * sizeof(*zoom.keep));
+	if (zoom.keep == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < zoom.m; i++)
+		if ((zoom.keep[i] = malloc(size)) == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+}
+
+static void *zoom_worker(void *arg)
+{
+	unsigned char *frame = zoom.frames[zoom.cur % 2];
+	int j;
+
+	while ((j = __atomic_fetch_add(&zoom.next_row, 1, __ATOMIC_RELAXED)) < zoom.height)
+		compute_row(zoom.cur, j, frame + (size_t)j * zoom.width);
+	return NULL;
+}
+
+/************
+ * Encoding *
+ ************/
+
+static unsigned char palette_rgb[256][3];
+static unsigned char palette_yuv[256][3];
+
+/* The xterm palette: 16 basic colors, a 6x6x6 cube and 24 grays */
+static void palette_init(void)
+{
+	static const unsigned char basic16[16][3] = {
+		{ 0x00, 0x00, 0x00 }, { 0xcd, 0x00, 0x00 }, { 0x00, 0xcd, 0x00 }, { 0xcd, 0xcd, 0x00 },
+		{ 0x00, 0x00, 0xee }, { 0xcd, 0x00, 0xcd }, { 0x00, 0xcd, 0xcd }, { 0xe5, 0xe5, 0xe5 },
+		{ 0x7f, 0x7f, 0x7f }, { 0xff, 0x00, 0x00 }, { 0x00, 0xff, 0x00 }, { 0xff, 0xff, 0x00 },
+		{ 0x5c, 0x5c, 0xff }, { 0xff, 0x00, 0xff }, { 0x00, 0xff, 0xff }, { 0xff, 0xff, 0xff },
+	};
+	static const unsigned char cube[6] = { 0x00, 0x5f, 0x87, 0xaf, 0xd7, 0xff };
+	unsigned char *rgb;
+	double r, g, b;
+	int c;
+
+	for (c = 0; c < 256; c++) {
+		rgb = palette_rgb[c];
+		if (c < 16) {
+			memcpy(rgb, basic16[c], 3);
+		} else if (c < 232) {
+			rgb[0] = cube[(c - 16) / 36];
+			rgb[1] = cube[(c - 16) / 6 % 6];
+			rgb[2] = cube[(c - 16) % 6];
+		} else {
+			rgb[0] = rgb[1] = rgb[2] = 8 + (c - 232) * 10;
+		}
+		/* full range BT.601, as JPEG: what C420jpeg means */
+		r = rgb[0];
+		g = rgb[1];
+		b = rgb[2];
+		palette_yuv[c][0] = lrint(0.299 * r + 0.587 * g + 0.114 * b);
+		palette_yuv[c][1] = lrint(128 - 0.168736 * r - 0.331264 * g + 0.5 * b);
+		palette_yuv[c][2] = lrint(128 + 0.5 * r - 0.418688 * g - 0.081312 * b);
+	}
+}
+
+/* Convert a frame into buf; returns its length */
+static size_t encode(const unsigned char *f, unsigned char *buf)
+{
+	int w = zoom.width, h = zoom.height, cw = (w + 1) / 2, ch = (h + 1) / 2;
+	unsigned char *y, *u, *v;
+	size_t len, i;
+	int x, j, dx, dy, n, su, sv;
+
+	if (zoom.format == FORMAT_PPM) {
+		len = sprintf((char *)buf, "P6\n%d %d\n255\n", w, h);
+		for (i = 0; i < (size_t)w * h; i++, len += 3)
+			memcpy(buf + len, palette_rgb[f[i]], 3);
+		return len;
+	}
+
+	len = sprintf((char *)buf, "FRAME\n");
+	y = buf + len;
+	u = y + (size_t)w * h;
+	v = u + (size_t)cw * ch;
+	for (i = 0; i < (size_t)w * h; i++)
+		y[i] = palette_yuv[f[i]][0];
+	/* chroma of 2x2 blocks, averaged */
+	for (j = 0; j < ch; j++)
+		for (x = 0; x < cw; x++) {
+			su = sv = n = 0;
+			for (dy = 0; dy < 2 && 2 * j + dy < h; dy++)
+				for (dx = 0; dx < 2 && 2 * x + dx < w; dx++, n++) {
+					su += palette_yuv[f[(size_t)(2 * j + dy) * w + 2 * x + dx]][1];
+					sv += palette_yuv[f[(size_t)(2 * j + dy) * w + 2 * x + dx]][2];
+				}
+			u[(size_t)j * cw + x] = (su + n / 2) / n;
+			v[(size_t)j * cw + x] = (sv + n / 2) / n;
+		}
+	return len + (size_t)w * h + 2 * (size_t)cw * ch;
+}
+
+static void *zoom_writer(void *arg)
+{
+	unsigned char *buf;
+	size_t len;
+	double start;
+	int k;
+
+	buf = malloc((size_t)zoom.width * zoom.height * 3 + 64);
+	if (buf == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	for (k = 0; k < zoom.nframes; k++) {
+		pthread_mutex_lock(&zoom.lock);
+		start = tune_now();
+		while (zoom.computed <= k)
+			pthread_cond_wait(&zoom.cond, &zoom.lock);
+		zoom.write_wait += tune_now() - start;
+		pthread_mutex_unlock(&zoom.lock);
+
+		start = tune_now();
+		len = encode(zoom.frames[k % 2], buf);
+		if (insist_write(zoom.fd, (char *)buf, len) != (ssize_t)len) {
+			perror("write");
+			exit(1);
+		}
+		zoom.encode_time += tune_now() - start;
+
+		pthread_mutex_lock(&zoom.lock);
+		zoom.written = k + 1;
+		pthread_cond_broadcast(&zoom.cond);
+		pthread_mutex_unlock(&zoom.lock);
+	}
+	free(buf);
+	return NULL;
+}
+
+/********
+ * Path *
+ ********/
+
+static int parse_viewport(const char *s, double v[4])
+{
+	char c;
+
+	if (sscanf(s, "%lf,%lf,%lf,%lf%c", &v[0], &v[1], &v[2], &v[3], &c) != 4 ||
+	    v[0] >= v[1] || v[2] >= v[3])
+		return -1;
+	return 0;
+}
+
+/*
+ * Lay out the zoom from a to b: the fixed point of the scaling that
+ * takes one to the other, on the pixel it falls on, and the frames
+ * per octave.
+ */
+static void plan_path(const double a[4], const double b[4])
+{
+	double sb, octaves, cax, cay, cbx, cby, u, v, fpo, miss;
+
+	zoom.xstep = (a[1] - a[0]) / zoom.width;
+	zoom.ystep = (a[3] - a[2]) / zoom.height;
+	sb = (b[1] - b[0]) / zoom.width;
+	if (sb == zoom.xstep) {
+		fprintf(stderr, "the viewports are the same size, there is nothing to zoom\n");
+		exit(1);
+	}
+	zoom.ratio = sb / zoom.xstep;
+	zoom.dir = zoom.ratio < 1 ? 1 : -1;
+
+	/* p stays put: c_b - p = (c_a - p) * ratio */
+	cax = (a[0] + a[1]) / 2;
+	cay = (a[2] + a[3]) / 2;
+	cbx = (b[0] + b[1]) / 2;
+	cby = (b[2] + b[3]) / 2;
+	zoom.px = (cbx - cax * zoom.ratio) / (1 - zoom.ratio);
+	zoom.py = (cby - cay * zoom.ratio) / (1 - zoom.ratio);
+	/* its pixel, the same in all frames; rounding moves each by < 1/2 pixel */
+	u = (zoom.px - a[0]) / zoom.xstep;
+	v = (a[3] - zoom.py) / zoom.ystep;
+	if (fabs(u) > 1e9 || fabs(v) > 1e9) {
+		fprintf(stderr, "the viewports are too far apart for their zoom\n");
+		exit(1);
+	}
+	zoom.ip = lrint(u);
+	zoom.jp = lrint(v);
+
+	/*
+	 * A whole number of frames per octave if that is the zoom asked
+	 * for, or with -s if rounding to one misses the end by at most
+	 * MAX_MISS octaves; otherwise the exact path, and nothing to reuse.
+	 */
+	octaves = fabs(log2(zoom.ratio));
+	fpo = (zoom.nframes - 1) / octaves;
+	zoom.m = lrint(fpo);
+	miss = zoom.m ? fabs((zoom.nframes - 1.0) / zoom.m - octaves) : 0;
+	if (zoom.m && miss > (zoom.snap ? MAX_MISS : EXACT_MISS))
+		zoom.m = 0;
+	if (zoom.m && miss > EXACT_MISS)
+		fprintf(stderr, "zoom: %.2f octaves, %d frames per octave: the last frame "
+			"is at %.4f of the scale asked for\n", octaves, zoom.m,
+			pow(2, -zoom.dir * (double)(zoom.nframes - 1) / zoom.m) / zoom.ratio);
+	else if (zoom.m)
+		fprintf(stderr, "zoom: %.2f octaves, %d frames per octave\n", octaves, zoom.m);
+	else
+		fprintf(stderr, "zoom: %.2f octaves in %d frames, %.2f frames per octave: "
+			"no samples to reuse%s\n", octaves, zoom.nframes, fpo,
+			zoom.snap ? "" : " (-s rounds it to whole frames)");
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t *workers, writer;
+	double a[4], b[4], start, elapsed, compute_time = 0, t;
+	const char *output = NULL;
+	char header[128];
+	int opt, i, k, ret, n, mb;
+
+	zoom.max_iter = 256;
+	zoom.reuse = 1;
+	zoom.fps = 30;
+	zoom.budget = 256UL << 20;
+	zoom.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	/* stop at WIDTHxHEIGHT: viewports start with a - more often than not */
+	while ((opt = getopt(argc, argv, "+f:o:r:i:T:M:sR")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (strcmp(optarg, "y4m") == 0)
+				zoom.format = FORMAT_Y4M;
+			else if (strcmp(optarg, "ppm") == 0)
+				zoom.format = FORMAT_PPM;
+			else
+				usage(argv[0]);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'r':
+			if (safe_atoi(optarg, &zoom.fps) < 0 || zoom.fps <= 0)
+				usage(argv[0]);
+			break;
+		case 'i':
+			if (safe_atoi(optarg, &zoom.max_iter) < 0 || zoom.max_iter <= 0)
+				usage(argv[0]);
+			break;
+		case 'T':
+			if (safe_atoi(optarg, &zoom.nthreads) < 0 || zoom.nthreads <= 0)
+				usage(argv[0]);
+			break;
+		case 'M':
+			if (safe_atoi(optarg, &mb) < 0 || mb <= 0)
+				usage(argv[0]);
+			zoom.budget = (size_t)mb << 20;
+			break;
+		case 's':
+			zoom.snap = 1;
+			break;
+		case 'R':
+			zoom.reuse = 0;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 4 || tile_parse_size(argv[optind], &zoom.width, &zoom.height) < 0 ||
+	    safe_atoi(argv[optind + 1], &zoom.nframes) < 0 || zoom.nframes <= 0 ||
+	    parse_viewport(argv[optind + 2], a) < 0 || parse_viewport(argv[optind + 3], b) < 0)
+		usage(argv[0]);
+
+	if (output == NULL) {
+		if (isatty(1)) {
+			fprintf(stderr, "not writing video to a terminal, use -o or a pipe\n");
+			exit(1);
+		}
+		zoom.fd = 1;
+	} else if ((zoom.fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror(output);
+		exit(1);
+	}
+
+	plan_path(a, b);
+	palette_init();
+	keep_init();
+	workers = malloc(zoom.nthreads * sizeof(*workers));
+	if (workers == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < 2; i++)
+		if ((zoom.frames[i] = malloc((size_t)zoom.width * zoom.height)) == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+
+	if (zoom.format == FORMAT_Y4M) {
+		n = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+			     zoom.width, zoom.height, zoom.fps);
+		if (insist_write(zoom.fd, header, n) != n) {
+			perror("write");
+			exit(1);
+		}
+	}
+
+	start = tune_now();
+	ret = pthread_create(&writer, NULL, zoom_writer, NULL);
+	for (k = 0; k < zoom.nframes && ret == 0; k++) {
+		/* the slot of frame k was written, and the writer is at most one behind */
+		pthread_mutex_lock(&zoom.lock);
+		t = tune_now();
+		while (zoom.written < k - 1)
+			pthread_cond_wait(&zoom.cond, &zoom.lock);
+		zoom.compute_wait += tune_now() - t;
+		pthread_mutex_unlock(&zoom.lock);
+
+		t = tune_now();
+		zoom.cur = k;
+		zoom.next_row = 0;
+		for (i = 0; i < zoom.nthreads && ret == 0; i++)
+			ret = pthread_create(&workers[i], NULL, zoom_worker, NULL);
+		while (i > 0)
+			pthread_join(workers[--i], NULL);
+		/* frame k - m was last read just now: its slot is frame k's */
+		if (zoom.keep && ret == 0)
+			keep_samples(k, zoom.frames[k % 2]);
+		compute_time += tune_now() - t;
+		zoom.samples += (size_t)zoom.width * zoom.height;
+
+		pthread_mutex_lock(&zoom.lock);
+		zoom.computed = k + 1;
+		pthread_cond_broadcast(&zoom.cond);
+		pthread_mutex_unlock(&zoom.lock);
+	}
+	if (ret) {
+		errno = ret;
+		perror("pthread_create");
+		exit(1);
+	}
+	pthread_join(writer, NULL);
+	elapsed = tune_now() - start;
+	if (zoom.fd != 1 && close(zoom.fd) < 0) {
+		perror(output);
+		exit(1);
+	}
+
+	fprintf(stderr, "%d frames of %dx%d, %d threads: %.4fs, %.2f frames/s, %.2f Mpixels/s\n",
+		zoom.nframes, zoom.width, zoom.height, zoom.nthreads, elapsed,
+		zoom.nframes / elapsed, zoom.samples / elapsed / 1e6);
+	fprintf(stderr, "computing %.4fs (%.1f%% of the pixels reused), encoding and writing %.4fs; "
+		"workers waited %.4fs for the writer, the writer %.4fs for workers\n",
+		compute_time, 100.0 * zoom.reused / zoom.samples, zoom.encode_time,
+		zoom.compute_wait, zoom.write_wait);
+
+	for (i = 0; i < 2; i++)
+		free(zoom.frames[i]);
+	if (zoom.keep) {
+		for (i = 0; i < zoom.m; i++)
+			free(zoom.keep[i]);
+		free(zoom.keep);
+	}
+	free(workers);
+	return 0;
+}
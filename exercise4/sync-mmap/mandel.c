@@ -0,0 +1,584 @@
+/*
+ * mandel.c
+ *
+ * A program to draw the Mandelbrot set on a 256-color xterm,
+ * with a choice of execution backends (threads or processes and
+ * the way they synchronize) running identical work.
+ *
+ * Built as `mandel', and as `mandel-fork' / `mandel-fork-sem' with
+ * a different DEFAULT_BACKEND.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/resource.h>
+
+#include "../helpers/mandel-lib.h"
+#include "backend.h"
+#include "batch.h"
+#include "equalize.h"
+#include "pool.h"
+#include "farm.h"
+#include "tune.h"
+
+#ifndef DEFAULT_BACKEND
+# define DEFAULT_BACKEND "pthread-sem"
+#endif
+
+/*
+ * Output at the terminal is is x_chars wide by y_chars long.
+*/
+int y_chars=50;
+int x_chars=90;
+
+/*
+ * The part of the complex plane to be drawn:
+ * upper left corner is (xmin, ymax), lower right corner is (xmax, ymin).
+*/
+double xmin=-1.8, xmax=1.0;
+double ymin=-1.0, ymax=1.0;
+
+/*
+ * Every character in the final output is
+ * xstep x ystep units wide on the complex plane.
+ */
+double xstep;
+double ystep;
+
+/*
+ * Deadline and interruption of the render in progress, shared with
+ * the workers.
+ */
+struct render_control *render_ctl;
+
+//helping functions
+
+void usage(char *argv0)
+{
+        fprintf(stderr, "Usage: %s [-b backend] [-a affinity] [-c chunk] [-t WxH [-O order]] [-m pages]\n"
+                "          [-T threads [-D domain]] [-S spawn] [-F addresses] [-n frames]\n"
+                "          [-P name] [-C cache] [-K checkpoint] [-d ms] [-p step] [-e] [-s]\n"
+                "          workers_count\n"
+                "       %s [-a affinity] [-t WxH] [-C cache] -J jobfile threads_count\n"
+                "       %s -L address\n\n"
+                "Exactly one argument required:\n"
+                "       workers_count: The number of threads or processes to create,\n"
+                "                      or `auto' to use tuned settings.\n"
+                "Options:\n"
+                "       -b backend:  one of the following. Default: " DEFAULT_BACKEND ".\n",
+                argv0, argv0, argv0);
+        backend_list(stderr);
+        fprintf(stderr,
+                "       -a affinity: none, compact, scatter or core (one per\n"
+                "                    physical core). Default: none.\n"
+                "       -c chunk:    rows (or tiles) handed to a worker at a time.\n"
+                "                    Default: 1.\n"
+                "       -t WxH:      compute in W x H tiles instead of full rows.\n"
+                "       -O order:    tile order: rows, columns or serpentine.\n"
+                "                    Default: rows. Backends that print while\n"
+                "                    rendering need rows.\n"
+                "       -m pages:    frame buffer pages: none, thp (transparent huge\n"
+                "                    pages) or hugetlb (MAP_HUGETLB). Default: none.\n"
+                "       -T threads:  threads per process, for fork-threads. Default: 1.\n"
+                "       -D domain:   pin each such process to the llc (last level\n"
+                "                    cache) or node of its threads' CPUs. Default: llc.\n"
+                "       -S spawn:    how process backends start workers: fork, vfork\n"
+                "                    or spawn (posix_spawn). Default: fork.\n"
+                "                    Only fork-pool supports all of them.\n"
+                "       -F addresses: comma separated workers of the farm backend,\n"
+                "                    unix:/path or host:port.\n"
+                "       -L address:  run as a farm worker listening at address.\n"
+                "       -P name:     publish the frame for viewers (mandel-view) in a\n"
+                "                    memfd (`memfd') or shared memory object (`/name').\n"
+                "       -C cache:    look tiles up in (and add them to) this cache file.\n"
+                "                    A new cache is " CACHE_SIZE_ENV " MB, default 64.\n"
+                "       -K checkpoint: keep the frame and the tiles done so far in\n"
+                "                    this file, so that an interrupted render run\n"
+                "                    again with the same view and -t only computes\n"
+                "                    the tiles it had not finished.\n"
+                "       -n frames:   render the frame this many times. Default: 1.\n"
+                "       -d ms, --deadline-ms ms:\n"
+                "                    give each frame (or a whole -J batch) ms\n"
+                "                    milliseconds; tiles not computed by then are\n"
+                "                    approximated and the frame is marked partial.\n"
+                "       -p step:     render progressively: every step-th pixel\n"
+                "                    first, drawn as blocks, then refined in passes\n"
+                "                    of step/2, ..., 1, each printed (or published)\n"
+                "                    as it completes. step is a power of two, e.g. 8.\n"
+                "                    Tiles are rounded up to multiples of step.\n"
+                "       -e:          color by histogram equalization of the\n"
+                "                    iteration counts instead of clamping them\n"
+                "                    to the 256 palette entries.\n"
+                "       -J jobfile:  render every view of jobfile, one per line:\n"
+                "                    `xmin xmax ymin ymax WxH max_iter output',\n"
+                "                    with one pool of threads (.pgm outputs get\n"
+                "                    images). Tiles are full rows unless -t is given.\n"
+                "       -s:          print the render time and page faults on stderr.\n");
+        exit(1);
+}
+
+/*
+ * Catch SIGINT (Ctrl-C) with the sigint_handler to ensure the prompt is not
+ * drawn in a funny colour if the user "terminates" the execution with Ctrl-C.
+ * Workers may be in the middle of a write, so the handler only tells them
+ * to hurry: the frame is finished with approximated tiles, and main()
+ * resets the colour and leaves.
+ */
+void sigint_handler(int signum)
+{
+        render_interrupt(render_ctl);
+}
+
+/* Settings shared by the calibration renders of the auto-tuner */
+struct tune_ctx {
+        const struct backend *backend;
+        struct mandel_job *job;
+        enum affinity_policy policy;
+};
+
+double calibration_render(int workers, int chunk, void *arg)
+{
+        struct tune_ctx *ctx=arg;
+        struct mandel_job job=*ctx->job;
+        struct frame frame;
+        int cpus[workers], ret;
+        double start, end;
+
+        /* a scratch frame, so the real one is first touched by its owners */
+        frame_alloc(&frame, job.frame->width, job.frame->height, job.frame->flags);
+        affinity_plan(job.topo, ctx->policy, workers, cpus);
+        job.nworkers=workers;
+        job.chunk=chunk;
+        job.cpus=cpus;
+        job.frame=&frame;
+        job.ckpt=NULL;  /* its units are not in this frame */
+        job.cache=NULL; /* hits would time the cache, not the configuration */
+        job.fd=-1;      /* compute only */
+
+        start=tune_now();
+        ret=ctx->backend->render(&job);
+        end=tune_now();
+        frame_free(&frame);
+        /* an interrupted render approximates: no use as a timing */
+        if(render_ctl->interrupted)
+                return TUNE_ABORT;
+        return ret<0 ? -1 : end-start;
+}
+
+/*
+ * Color a frame of iteration counts into colored and output that,
+ * which the render left to us.
+ */
+void equalize_output(struct mandel_job *job, struct frame *colored, int fd, int n, int stats)
+{
+        struct mandel_job out=*job;
+        struct equalize_stats st;
+
+        if(equalize_frame(job->frame, colored, job->vp.max_iter, job->nworkers, &st)<0)
+                exit(1);
+        out.frame=colored;
+        out.fd=fd;
+        output_frame(&out);
+        if(stats)
+                fprintf(stderr, "frame %d: equalized in %.4fs: histograms %.4fs, merge %.4fs, "
+                        "scan %.4fs, map %.4fs\n", n, st.histogram+st.merge+st.scan+st.map,
+                        st.histogram, st.merge, st.scan, st.map);
+}
+
+/*
+ * Render and output one frame. A progressive frame takes passes of
+ * step job->progressive, then half that, down to 1, each one published
+ * and printed (over the previous one on a terminal) as it completes.
+ * Passes stop at the deadline, leaving the blocks of the last one.
+ * A frame of iteration counts is output once complete, equalized into
+ * colored.
+ */
+void render_frame(const struct backend *backend, struct mandel_job *job,
+                  struct frame *colored, int n, int stats)
+{
+        double start=tune_now();
+        char up[32];
+        int len, last, fd=job->fd;
+
+        job->step=job->progressive;
+        if(colored)
+                job->fd=-1;
+        for(;;) {
+                frame_begin(job->frame);
+                if(backend->render(job)<0)
+                        exit(1);
+                if(colored) {
+                        equalize_output(job, colored, fd, n, stats);
+                        job->fd=fd;
+                }
+                /* the finest pass, or the one the deadline caught up with */
+                last=job->step<=1 || render_expired(render_ctl);
+                if(render_ctl->approximated && !job->progressive) {
+                        frame_mark_partial(job->frame, render_ctl->approximated);
+                        fprintf(stderr, "frame %d is partial: %u of %d tiles approximated (%s)\n",
+                                n, render_ctl->approximated, job->grid.ntiles,
+                                render_ctl->interrupted ? "interrupted" : "deadline");
+                } else if(last && (job->step>1 || render_ctl->approximated)) {
+                        frame_mark_partial(job->frame, job->grid.ntiles);
+                        fprintf(stderr, "frame %d is partial: refined down to step %d, "
+                                "%u of %d tiles only to step %d (%s)\n",
+                                n, job->step, render_ctl->approximated, job->grid.ntiles,
+                                2*job->step, render_ctl->interrupted ? "interrupted" : "deadline");
+                }
+                frame_end(job->frame);
+                if(job->progressive && stats)
+                        fprintf(stderr, "frame %d: pass %d done at %.4fs\n",
+                                n, job->step, tune_now()-start);
+                if(last)
+                        break;
+
+                job->step/=2;
+                if(job->fd>=0 && isatty(job->fd)) {
+                        len=snprintf(up, sizeof(up), "\033[%dA", job->frame->height);
+                        if(insist_write(job->fd, up, len)!=len) {
+                                perror("write");
+                                exit(1);
+                        }
+                }
+        }
+}
+
+int main(int argc, char *argv[])
+{
+        int opt, nworkers=0, chunk=1, nframes=1, nthreads=1, n, deadline_ms=0, progressive=0;
+        int autotune=0, use_tiles=0, stats=0, frame_flags=0, equalize=0;
+        int tile_w, tile_h;
+        int *cpus;
+        double start, elapsed;
+        struct rusage ru_self, ru_children;
+        const struct backend *backend;
+        enum affinity_policy policy=AFFINITY_NONE;
+        enum tile_order order=TILE_ORDER_ROWS;
+        struct cpu_topology topo={ 0 };
+        struct frame frame, colored;
+        struct mandel_job job;
+        enum spawn_method spawn=SPAWN_FORK;
+        enum affinity_domain domain=AFFINITY_DOMAIN_LLC;
+        const char *farm=NULL, *publish=NULL, *cache_path=NULL, *batch=NULL, *ckpt_path=NULL;
+        static const struct option long_options[]={
+                { "deadline-ms", required_argument, NULL, 'd' },
+                { NULL, 0, NULL, 0 }
+        };
+
+        /* Maybe we were exec'ed as a worker of a fork-pool */
+        pool_worker_hook();
+
+        xstep=(xmax - xmin) / x_chars;
+        ystep=(ymax - ymin) / y_chars;
+
+        backend=backend_find(DEFAULT_BACKEND);
+        while((opt=getopt_long(argc, argv, "b:a:c:t:O:m:T:D:S:F:L:P:C:K:n:J:d:p:es",
+                               long_options, NULL))!=-1) {
+                switch(opt) {
+                case 'b':
+                        if((backend=backend_find(optarg))==NULL) {
+                                fprintf(stderr, "`%s' is not an available backend\n", optarg);
+                                exit(1);
+                        }
+                        break;
+                case 'a':
+                        if(affinity_parse_policy(optarg, &policy)<0) {
+                                fprintf(stderr, "`%s' is not a valid affinity policy\n", optarg);
+                                exit(1);
+                        }
+                        break;
+                case 'c':
+                        if(safe_atoi(optarg, &chunk)<0 || chunk<=0) {
+                                fprintf(stderr, "`%s' is not valid for `chunk'\n", optarg);
+                                exit(1);
+                        }
+                        break;
+                case 't':
+                        if(tile_parse_size(optarg, &tile_w, &tile_h)<0) {
+                                fprintf(stderr, "`%s' is not valid for `tile size'\n", optarg);
+                                exit(1);
+                        }
+                        use_tiles=1;
+                        break;
+                case 'O':
+                        if(tile_parse_order(optarg, &order)<0) {
+                                fprintf(stderr, "`%s' is not a valid tile order\n", optarg);
+                                exit(1);
+                        }
+                        break;
+                case 'm':
+                        if(frame_parse_pages(optarg, &frame_flags)<0) {
+                                fprintf(stderr, "`%s' is not valid for `pages'\n", optarg);
+                                exit(1);
+                        }
+                        break;
+                case 'T':
+                        if(safe_atoi(optarg, &nthreads)<0 || nthreads<=0) {
+                                fprintf(stderr, "`%s' is not valid for `threads'\n", optarg);
+                                exit(1);
+                        }
+                        break;
+                case 'D':
+                        if(affinity_parse_domain(optarg, &domain)<0) {
+                                fprintf(stderr, "`%s' is not a valid domain\n", optarg);
+                                exit(1);
+                        }
+                        break;
+                case 'S':
+                        if(spawn_parse_method(optarg, &spawn)<0) {
+                                fprintf(stderr, "`%s' is not a valid spawn method\n", optarg);
+                                exit(1);
+                        }
+                        break;
+                case 'F':
+                        farm=optarg;
+                        break;
+                case 'L':
+                        exit(farm_serve(optarg)<0 ? 1 : 0);
+                case 'P':
+                        publish=optarg;
+                        break;
+                case 'C':
+                        cache_path=optarg;
+                        break;
+                case 'K':
+                        ckpt_path=optarg;
+                        break;
+                case 'n':
+                        if(safe_atoi(optarg, &nframes)<0 || nframes<=0) {
+                                fprintf(stderr, "`%s' is not valid for `frames'\n", optarg);
+                                exit(1);
+                        }
+                        break;
+                case 'J':
+                        batch=optarg;
+                        break;
+                case 'd':
+                        if(safe_atoi(optarg, &deadline_ms)<0 || deadline_ms<=0) {
+                                fprintf(stderr, "`%s' is not valid for `deadline'\n", optarg);
+                                exit(1);
+                        }
+                        break;
+                case 'p':
+                        if(safe_atoi(optarg, &progressive)<0 || progressive<=0 ||
+                           progressive>64 || (progressive & (progressive-1))) {
+                                fprintf(stderr, "`%s' is not valid for `step'\n", optarg);
+                                exit(1);
+                        }
+                        break;
+                case 'e':
+                        equalize=1;
+                        break;
+                case 's':
+                        stats=1;
+                        break;
+                default:
+                        usage(argv[0]);
+                }
+        }
+        if(argc-optind!=1)
+                usage(argv[0]);
+        if(strcmp(argv[optind], "auto")==0) {
+                autotune=1;
+        } else if(safe_atoi(argv[optind], &nworkers)<0 || nworkers<=0) {
+                fprintf(stderr, "`%s' is not valid for `workers_count'\n", argv[optind]);
+                exit(1);
+        }
+        if(backend->ordered && order!=TILE_ORDER_ROWS) {
+                fprintf(stderr, "backend `%s' prints while rendering and needs `-O rows'\n",
+                        backend->name);
+                exit(1);
+        }
+        if(progressive && backend==&backend_farm) {
+                fprintf(stderr, "farm workers compute whole tiles, no progressive rendering\n");
+                exit(1);
+        }
+        if(ckpt_path && (backend==&backend_farm || backend==&backend_fork_pool)) {
+                fprintf(stderr, "backend `%s' fills the frame from buffers of its own, "
+                        "no checkpoints\n", backend->name);
+                exit(1);
+        }
+        if(equalize && (progressive || publish || batch)) {
+                fprintf(stderr, "-e colors whole frames of iteration counts, it does not go "
+                        "with -p, -P or -J\n");
+                exit(1);
+        }
+        if(ckpt_path && (progressive || publish || batch)) {
+                fprintf(stderr, "-K does not go with -p, -P or -J\n");
+                exit(1);
+        }
+        if(batch && (progressive || nframes>1)) {
+                fprintf(stderr, "-J renders every view once, it does not go with -p or -n\n");
+                exit(1);
+        }
+
+	 /*
+         * signal handling
+         */
+        struct sigaction sa;
+        render_ctl=create_shared_memory_area(sizeof(*render_ctl));
+        sa.sa_handler=sigint_handler;
+        /* workers blocked in a wait carry on, and see the flag */
+        sa.sa_flags=SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if(sigaction(SIGINT, &sa, NULL)<0) {
+                perror("sigaction");
+                exit(1);
+        }
+
+        if(policy!=AFFINITY_NONE && topology_read(&topo)<0)
+                policy=AFFINITY_NONE;
+
+        /* Rows are full-width, one row high tiles */
+        memset(&job, 0, sizeof(job));
+        job.vp=(struct viewport){ xmin, ymax, xstep, ystep, MANDEL_MAX_ITERATION };
+        if(progressive) {
+                /* a block of a pass must not straddle two units */
+                if(!use_tiles) {
+                        tile_w=x_chars;
+                        tile_h=1;
+                        use_tiles=1;
+                }
+                if(tile_w<x_chars)
+                        tile_w=(tile_w+progressive-1)/progressive*progressive;
+                tile_h=(tile_h+progressive-1)/progressive*progressive;
+        }
+        if(use_tiles)
+                tile_grid_init(&job.grid, x_chars, y_chars, tile_w, tile_h, order);
+        else
+                tile_grid_init(&job.grid, x_chars, y_chars, x_chars, 1, TILE_ORDER_ROWS);
+        job.topo=&topo;
+        job.frame=&frame;
+        job.fd=1;
+        job.spawn=spawn;
+        job.threads=nthreads;
+        job.domain=domain;
+        job.farm=farm;
+        job.ctl=render_ctl;
+        job.iterations=equalize;
+        if(cache_path) {
+                size_t size=CACHE_SIZE_DEFAULT;
+
+                if(getenv(CACHE_SIZE_ENV))
+                        size=strtoul(getenv(CACHE_SIZE_ENV), NULL, 10) << 20;
+                if((job.cache=cache_open(cache_path, size))==NULL)
+                        exit(1);
+        }
+        if(backend->shared_frame)
+                frame_flags|=FRAME_SHARED;
+        if(ckpt_path) {
+                if((job.ckpt=checkpoint_open(ckpt_path, &job.vp, &job.grid, equalize, &frame))==NULL)
+                        exit(1);
+                if((n=checkpoint_count(job.ckpt))>0)
+                        fprintf(stderr, "%s: resuming, %d of %d tiles done\n",
+                                ckpt_path, n, job.grid.ntiles);
+        } else if(publish)
+                frame_publish(&frame, x_chars, y_chars, frame_flags, publish);
+        else
+                frame_alloc(&frame, x_chars, y_chars, frame_flags);
+        if(equalize)
+                frame_alloc(&colored, x_chars, y_chars, 0);
+
+        /*
+         * Pick the worker count and chunk size from the tuning cache,
+         * calibrating this backend on this machine the first time.
+         */
+        if(autotune) {
+                char key[TUNE_KEYLEN];
+                struct tune_ctx ctx={ backend, &job, policy };
+                struct tune_result res;
+
+                tune_make_key(key, sizeof(key), backend->name, x_chars, y_chars,
+                              job.grid.tile_w, job.grid.tile_h, job.vp.max_iter);
+                tune_get(key, calibration_render, &ctx, job.grid.ntiles / 2, &res);
+                nworkers=res.workers;
+                chunk=res.chunk;
+        }
+
+        /*
+         * Decide which CPU every worker runs on before any of them exists,
+         * so that the rows a worker writes can be placed on its NUMA node.
+         */
+        cpus=malloc(nworkers * sizeof(*cpus));
+        if(cpus==NULL) {
+                fprintf(stderr, "Out of memory\n");
+                exit(1);
+        }
+        affinity_plan(&topo, policy, nworkers, cpus);
+        job.nworkers=nworkers;
+        job.chunk=chunk;
+        job.cpus=cpus;
+
+        /* Many views instead of the one of the globals */
+        if(batch) {
+                if(deadline_ms)
+                        render_ctl->deadline=tune_now()+deadline_ms/1e3;
+                n=batch_run(batch, &job, use_tiles ? tile_w : 0, tile_h);
+                if(render_ctl->approximated)
+                        fprintf(stderr, "batch: %u tiles approximated (%s)\n",
+                                render_ctl->approximated,
+                                render_ctl->interrupted ? "interrupted" : "deadline");
+                if(job.cache) {
+                        if(stats)
+                                cache_print_stats(job.cache, stderr);
+                        cache_close(job.cache);
+                }
+                frame_free(&frame);
+                topology_free(&topo);
+                free(cpus);
+                return n<0 || render_ctl->interrupted ? 1 : 0;
+        }
+
+        /* a checkpoint's frame is page cache, not ours to place */
+        if(policy!=AFFINITY_NONE && !job.ckpt)
+                frame_bind_units(&job);
+        job.progressive=progressive;
+
+        /* Backends that keep workers across frames only start them once */
+        job.spawn_time=0;
+        start=tune_now();
+        for(n=0; n<nframes && !render_ctl->interrupted; n++) {
+                render_ctl->deadline=deadline_ms ? tune_now()+deadline_ms/1e3 : 0;
+                render_ctl->expired=0;
+                render_ctl->approximated=0;
+                render_frame(backend, &job, equalize ? &colored : NULL, n, stats);
+        }
+        elapsed=tune_now()-start;
+        if(backend->cleanup)
+                backend->cleanup();
+        if(stats) {
+                getrusage(RUSAGE_SELF, &ru_self);
+                getrusage(RUSAGE_CHILDREN, &ru_children);
+                fprintf(stderr, "%s: %d workers, chunk %d, %d units: %.4fs, %ld page faults\n",
+                        backend->name, nworkers, chunk, job.grid.ntiles, elapsed,
+                        ru_self.ru_minflt+ru_self.ru_majflt+
+                        ru_children.ru_minflt+ru_children.ru_majflt);
+                fprintf(stderr, "%s: %d frames: %.4fs per frame, %.4fs spawning workers (%.4fs per frame)\n",
+                        backend->name, nframes, elapsed/nframes,
+                        job.spawn_time, job.spawn_time/nframes);
+                if(job.cache)
+                        cache_print_stats(job.cache, stderr);
+        }
+        if(job.cache)
+                cache_close(job.cache);
+
+        if(job.ckpt) {
+                n=checkpoint_count(job.ckpt);
+                if(n<job.grid.ntiles)
+                        fprintf(stderr, "%s: %d of %d tiles done, run again to resume\n",
+                                ckpt_path, n, job.grid.ntiles);
+                checkpoint_close(job.ckpt);
+        } else
+                frame_free(&frame);
+        if(equalize)
+                frame_free(&colored);
+        topology_free(&topo);
+        free(cpus);
+        reset_xterm_color(1);
+        return render_ctl->interrupted ? 1 : 0;
+}
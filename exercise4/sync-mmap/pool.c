@@ -0,0 +1,481 @@
+/*
+ * pool.c
+ *
+ * A prefork pool: worker processes that stay alive between frames and
+ * receive frame jobs through a ring in a shared memory arena, woken by
+ * a futex doorbell.
+ *
+ * The arena is a memfd, so that workers started with vfork() or
+ * posix_spawn() and an exec of this program can map it too; workers
+ * started with fork() simply inherit the mapping.
+ * It holds a control block, and per ring slot a job descriptor, a
+ * work queue and a frame. Everything in it is addressed by offsets.
+ *
+ * Workers never leave a live pool, so the parent, whenever it waits on
+ * them, wakes up now and then to check that none has: one that died
+ * would leave its units or its check-in undone for good.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "pool.h"
+#include "workq.h"
+#include "tune.h"
+
+#define POOL_RING	2		/* frames in flight */
+#define SLOT_FREE	UINT_MAX	/* slot being (re)filled */
+#define ALIGN		64
+#define CHECK_MS	100		/* how often a waiting parent checks on workers */
+
+extern char **environ;
+
+/* A frame job, as passed through the ring: no pointers */
+struct pool_job {
+	struct viewport vp;
+	struct tile_grid grid;
+	int chunk;
+	int progressive, step;
+	int iterations;
+	struct render_control ctl;	/* the parent forwards interruptions */
+};
+
+struct pool_slot {
+	unsigned int seq;	/* job in this slot, SLOT_FREE while refilled */
+	unsigned int users;	/* workers currently taking units from it */
+	struct pool_job job;
+	size_t q_off;		/* its work queue */
+	size_t frame_off;	/* its frame */
+};
+
+struct pool_ctl {
+	unsigned int seq;	/* doorbell: number of jobs submitted */
+	unsigned int ready;	/* number of workers up */
+	unsigned int quit;
+	int width, height;
+	size_t pitch;
+	struct pool_slot slot[POOL_RING];
+};
+
+/* The parent's view of the pool */
+struct pool {
+	int fd;
+	char *arena;
+	size_t size;
+	int nworkers;
+	int *cpus;
+	pid_t *pids;
+	enum spawn_method how;
+	int nunits;
+	unsigned int next_seq;
+};
+
+static size_t align_up(size_t n)
+{
+	return (n + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+/**********
+ * Worker *
+ **********/
+
+static void pool_work(char *arena, unsigned int seq)
+{
+	struct pool_ctl *ctl = (struct pool_ctl *)arena;
+	struct pool_slot *slot = &ctl->slot[seq % POOL_RING];
+	struct workq *q;
+	struct mandel_job job;
+	struct frame frame;
+	int u, first, last;
+
+	/*
+	 * Register as a user before checking the slot: the parent marks
+	 * the slot free, then waits for users to drop to zero before
+	 * refilling it, so a late worker never takes units of a newer job.
+	 */
+	__atomic_fetch_add(&slot->users, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) == seq) {
+		memset(&job, 0, sizeof(job));
+		job.vp = slot->job.vp;
+		job.grid = slot->job.grid;
+		job.ctl = &slot->job.ctl;
+		job.progressive = slot->job.progressive;
+		job.step = slot->job.step;
+		job.iterations = slot->job.iterations;
+		job.frame = &frame;
+		frame.base = (int *)(arena + slot->frame_off);
+		frame.pitch = ctl->pitch;
+		frame.width = ctl->width;
+		frame.height = ctl->height;
+
+		q = (struct workq *)(arena + slot->q_off);
+		while (workq_take(q, &first, &last) == 0) {
+			for (u = first; u < last; u++) {
+				compute_unit(&job, u);
+				workq_complete(q, u);
+			}
+		}
+	}
+	__atomic_fetch_sub(&slot->users, 1, __ATOMIC_SEQ_CST);
+}
+
+static void pool_serve(char *arena, int cpu)
+{
+	struct pool_ctl *ctl = (struct pool_ctl *)arena;
+	unsigned int next, cur;
+
+	/* don't outlive a parent killed before it could destroy the pool */
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+	if (getppid() == 1)
+		return;
+	affinity_pin_process(0, cpu);
+
+	/* jobs submitted before we came up are ours too */
+	next = 0;
+	__atomic_fetch_add(&ctl->ready, 1, __ATOMIC_SEQ_CST);
+	futex_wake(&ctl->ready, 1);
+
+	for (;;) {
+		cur = __atomic_load_n(&ctl->seq, __ATOMIC_SEQ_CST);
+		/* quit is set before the doorbell rings for the last time */
+		if (__atomic_load_n(&ctl->quit, __ATOMIC_SEQ_CST))
+			return;
+		if (cur == next) {
+			futex_wait(&ctl->seq, next);
+			continue;
+		}
+		for (; next != cur; next++)
+			pool_work(arena, next);
+	}
+}
+
+void pool_worker_hook(void)
+{
+	const char *env = getenv(POOL_WORKER_ENV);
+	struct stat st;
+	char *arena;
+	int fd, cpu;
+
+	if (env == NULL)
+		return;
+	/* Ctrl-C reaches us too: leave it to the parent, see pool_run() */
+	signal(SIGINT, SIG_IGN);
+	if (sscanf(env, "%d:%d", &fd, &cpu) != 2) {
+		fprintf(stderr, "%s: bad value `%s'\n", POOL_WORKER_ENV, env);
+		_exit(1);
+	}
+	if (fstat(fd, &st) < 0) {
+		perror("pool worker: fstat");
+		_exit(1);
+	}
+	arena = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (arena == MAP_FAILED) {
+		perror("pool worker: mmap");
+		_exit(1);
+	}
+	pool_serve(arena, cpu);
+	_exit(0);
+}
+
+/**********
+ * Parent *
+ **********/
+
+static pid_t spawn_exec(struct pool *pool, int cpu)
+{
+	static char *argv[] = { "mandel-pool-worker", NULL };
+	char var[64];
+	char **envp;
+	pid_t pid;
+	int n, ret;
+
+	/* our environment plus POOL_WORKER_ENV, built before vfork() */
+	for (n = 0; environ[n]; n++)
+		;
+	envp = malloc((n + 2) * sizeof(*envp));
+	if (envp == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	memcpy(envp, environ, n * sizeof(*envp));
+	snprintf(var, sizeof(var), POOL_WORKER_ENV "=%d:%d", pool->fd, cpu);
+	envp[n] = var;
+	envp[n + 1] = NULL;
+
+	if (pool->how == SPAWN_POSIX_SPAWN) {
+		ret = posix_spawn(&pid, "/proc/self/exe", NULL, NULL, argv, envp);
+		if (ret) {
+			errno = ret;
+			perror("posix_spawn");
+			pid = -1;
+		}
+	} else {
+		pid = vfork();
+		if (pid == 0) {
+			execve("/proc/self/exe", argv, envp);
+			_exit(127);
+		}
+		if (pid < 0)
+			perror("vfork");
+	}
+	free(envp);
+	return pid;
+}
+
+static pid_t spawn_worker(struct pool *pool, int i)
+{
+	pid_t pid;
+
+	switch (pool->how) {
+	case SPAWN_FORK:
+		pid = fork();
+		if (pid == 0) {
+			pool_serve(pool->arena, pool->cpus[i]);
+			_exit(0);
+		}
+		if (pid < 0)
+			perror("fork");
+		return pid;
+	default:
+		return spawn_exec(pool, pool->cpus[i]);
+	}
+}
+
+/*
+ * Reap the workers that are gone, and complain and return -1 if there
+ * were any: workers only exit once the pool is destroyed.
+ */
+static int pool_check_workers(struct pool *pool)
+{
+	int i, status, gone = 0;
+
+	for (i = 0; i < pool->nworkers; i++) {
+		if (pool->pids[i] <= 0 || waitpid(pool->pids[i], &status, WNOHANG) == 0)
+			continue;
+		pool->pids[i] = 0;
+		gone++;
+	}
+	if (gone == 0)
+		return 0;
+	fprintf(stderr, "pool: %d of %d workers died\n", gone, pool->nworkers);
+	return -1;
+}
+
+/* Kill and reap the workers left, for a pool that lost some */
+static void pool_kill_workers(struct pool *pool)
+{
+	int i;
+
+	for (i = 0; i < pool->nworkers; i++) {
+		if (pool->pids[i] <= 0)
+			continue;
+		kill(pool->pids[i], SIGKILL);
+		if (waitpid(pool->pids[i], NULL, 0) < 0)
+			perror("pool: waitpid");
+		pool->pids[i] = 0;
+	}
+}
+
+struct pool *pool_create(int nworkers, const int *cpus, enum spawn_method how,
+			 int width, int height, size_t pitch, int nunits,
+			 double *spawn_time)
+{
+	struct pool_ctl *ctl;
+	struct pool *pool;
+	size_t off, qsize, fsize;
+	unsigned int r;
+	double start;
+	int i;
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL ||
+	    (pool->cpus = malloc(nworkers * sizeof(int))) == NULL ||
+	    (pool->pids = calloc(nworkers, sizeof(pid_t))) == NULL) {
+		fprintf(stderr, "Out of memory, failed to allocate pool\n");
+		exit(1);
+	}
+	memcpy(pool->cpus, cpus, nworkers * sizeof(int));
+	pool->nworkers = nworkers;
+	pool->how = how;
+	pool->nunits = nunits;
+
+	/* Lay the arena out: control block, then per slot a queue and a frame */
+	qsize = align_up(workq_size(nunits));
+	fsize = align_up((size_t)height * pitch * sizeof(int));
+	off = align_up(sizeof(struct pool_ctl));
+	pool->size = off + POOL_RING * (qsize + fsize);
+
+	pool->fd = memfd_create("mandel-pool", 0);
+	if (pool->fd < 0 || ftruncate(pool->fd, pool->size) < 0) {
+		perror("pool: memfd");
+		exit(1);
+	}
+	pool->arena = mmap(NULL, pool->size, PROT_READ | PROT_WRITE, MAP_SHARED, pool->fd, 0);
+	if (pool->arena == MAP_FAILED) {
+		perror("pool: mmap");
+		exit(1);
+	}
+
+	ctl = (struct pool_ctl *)pool->arena;
+	ctl->width = width;
+	ctl->height = height;
+	ctl->pitch = pitch;
+	for (i = 0; i < POOL_RING; i++) {
+		ctl->slot[i].seq = SLOT_FREE;
+		ctl->slot[i].q_off = off;
+		ctl->slot[i].frame_off = off + qsize;
+		off += qsize + fsize;
+	}
+
+	start = tune_now();
+	for (i = 0; i < nworkers; i++) {
+		pool->pids[i] = spawn_worker(pool, i);
+		if (pool->pids[i] < 0) {
+			pool->nworkers = i;
+			pool_destroy(pool);
+			return NULL;
+		}
+	}
+	/*
+	 * up means ready for work: wait for every worker to check in, or
+	 * find one that never will (its exec failed, or it found itself
+	 * orphaned)
+	 */
+	while ((r = __atomic_load_n(&ctl->ready, __ATOMIC_SEQ_CST)) < (unsigned int)nworkers)
+		if (futex_wait_timeout(&ctl->ready, r, CHECK_MS) < 0 &&
+		    pool_check_workers(pool) < 0) {
+			pool_kill_workers(pool);
+			pool_destroy(pool);
+			return NULL;
+		}
+	*spawn_time = tune_now() - start;
+
+	return pool;
+}
+
+void pool_destroy(struct pool *pool)
+{
+	struct pool_ctl *ctl = (struct pool_ctl *)pool->arena;
+	int i, status;
+
+	__atomic_store_n(&ctl->quit, 1, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add(&ctl->seq, 1, __ATOMIC_SEQ_CST);
+	futex_wake(&ctl->seq, INT_MAX);
+
+	/* workers already reaped have a pid of 0 */
+	for (i = 0; i < pool->nworkers; i++)
+		if (pool->pids[i] > 0 && waitpid(pool->pids[i], &status, 0) < 0)
+			perror("pool: waitpid");
+
+	munmap(pool->arena, pool->size);
+	close(pool->fd);
+	free(pool->pids);
+	free(pool->cpus);
+	free(pool);
+}
+
+int pool_fits(const struct pool *pool, const struct mandel_job *job)
+{
+	const struct pool_ctl *ctl = (const struct pool_ctl *)pool->arena;
+
+	return pool->nworkers == job->nworkers &&
+	       pool->how == job->spawn &&
+	       memcmp(pool->cpus, job->cpus, job->nworkers * sizeof(int)) == 0 &&
+	       pool->nunits == job->grid.ntiles &&
+	       ctl->width == job->frame->width &&
+	       ctl->height == job->frame->height &&
+	       ctl->pitch == job->frame->pitch;
+}
+
+int pool_run(struct pool *pool, struct mandel_job *job)
+{
+	struct pool_ctl *ctl = (struct pool_ctl *)pool->arena;
+	unsigned int seq = pool->next_seq++;
+	struct pool_slot *slot = &ctl->slot[seq % POOL_RING];
+	struct mandel_job view;
+	struct frame frame;
+	struct workq *q;
+	double check;
+	int u;
+
+	/*
+	 * Take the slot back from late workers of its previous job; one
+	 * that died in it never leaves, so check on them as we wait.
+	 */
+	__atomic_store_n(&slot->seq, SLOT_FREE, __ATOMIC_SEQ_CST);
+	check = tune_now() + CHECK_MS / 1e3;
+	while (__atomic_load_n(&slot->users, __ATOMIC_SEQ_CST)) {
+		sched_yield();
+		if (tune_now() < check)
+			continue;
+		if (pool_check_workers(pool) < 0) {
+			pool_kill_workers(pool);
+			return -1;
+		}
+		check = tune_now() + CHECK_MS / 1e3;
+	}
+
+	q = (struct workq *)(pool->arena + slot->q_off);
+	workq_init(q, job->grid.ntiles, job->chunk);
+	slot->job.vp = job->vp;
+	slot->job.grid = job->grid;
+	slot->job.chunk = job->chunk;
+	slot->job.progressive = job->progressive;
+	slot->job.step = job->step;
+	slot->job.iterations = job->iterations;
+	memset(&slot->job.ctl, 0, sizeof(slot->job.ctl));
+	if (job->ctl)
+		slot->job.ctl.deadline = job->ctl->deadline;
+	/* a progressive pass refines the previous one, done in another slot */
+	if (job->progressive && job->step < job->progressive)
+		memcpy(pool->arena + slot->frame_off, job->frame->base,
+		       job->frame->height * job->frame->pitch * sizeof(int));
+	__atomic_store_n(&slot->seq, seq, __ATOMIC_SEQ_CST);
+
+	/* ring the doorbell */
+	__atomic_store_n(&ctl->seq, seq + 1, __ATOMIC_SEQ_CST);
+	futex_wake(&ctl->seq, INT_MAX);
+
+	/* Print from the slot's frame as units complete */
+	frame = *job->frame;
+	frame.base = (int *)(pool->arena + slot->frame_off);
+	frame.pub = NULL;	/* the rows are only ready once copied */
+	view = *job;
+	view.frame = &frame;
+	view.ctl = NULL;
+	for (u = 0; u < job->grid.ntiles; u++) {
+		for (;;) {
+			/* exec'ed workers ignore SIGINT: pass it on while we wait */
+			if (job->ctl && __atomic_load_n(&job->ctl->interrupted, __ATOMIC_RELAXED))
+				render_interrupt(&slot->job.ctl);
+			if (workq_wait_timeout(q, u, CHECK_MS) == 0)
+				break;
+			if (pool_check_workers(pool) < 0) {
+				pool_kill_workers(pool);
+				return -1;
+			}
+		}
+		output_unit(&view, u);
+	}
+	if (job->ctl)
+		job->ctl->approximated += slot->job.ctl.approximated;
+
+	memcpy(job->frame->base, frame.base, job->frame->height * job->frame->pitch * sizeof(int));
+	frame_rows_ready(job->frame, 0, job->frame->height);
+	return 0;
+}
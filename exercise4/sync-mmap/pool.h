@@ -0,0 +1,49 @@
+/*
+ * pool.h
+ *
+ * A prefork pool: worker processes that stay alive between frames and
+ * receive frame jobs through a ring in a shared memory arena, woken by
+ * a futex doorbell.
+ *
+ */
+
+#ifndef POOL_H__
+#define POOL_H__
+
+#include "render.h"
+
+/* Environment variable telling an exec'ed program it is a pool worker */
+#define POOL_WORKER_ENV	"MANDEL_POOL_WORKER"
+
+struct pool;
+
+/*
+ * Start nworkers workers (pinned to cpus[i]) for frames of up to
+ * width x height, with the given row pitch and units per frame.
+ * Returns NULL on failure; *spawn_time is the time until every
+ * worker was up and waiting for work.
+ */
+struct pool *pool_create(int nworkers, const int *cpus, enum spawn_method how,
+			 int width, int height, size_t pitch, int nunits,
+			 double *spawn_time);
+void pool_destroy(struct pool *pool);
+
+/* Can this pool render job without being re-created? */
+int pool_fits(const struct pool *pool, const struct mandel_job *job);
+
+/*
+ * Hand job to the pool, print its rows in order as they are done and
+ * leave the finished frame in job->frame. Returns 0 on success, -1 if
+ * workers died, in which case the others are killed too and the pool
+ * can only be destroyed.
+ */
+int pool_run(struct pool *pool, struct mandel_job *job);
+
+/*
+ * If this process was exec'ed as a pool worker (POOL_WORKER_ENV is
+ * set), serve jobs until the pool is destroyed and exit. Otherwise
+ * return.
+ */
+void pool_worker_hook(void);
+
+#endif /* POOL_H__ */
@@ -0,0 +1,293 @@
+/*
+ * render.c
+ *
+ * The work and output paths shared by all execution backends:
+ * a render job, the units of work it is split into and the
+ * ordered output of finished rows.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../helpers/mandel-lib.h"
+#include "render.h"
+#include "tune.h"
+
+#define OUTBUF_SIZE	4096
+
+/*
+ * Approximated units sample every APPROX_STEP-th pixel. Colors stop
+ * changing at 255 iterations, so APPROX_ITER loses nothing on the
+ * samples themselves while sparing them deep iteration caps.
+ */
+#define APPROX_STEP	4
+#define APPROX_ITER	256
+
+/*****************
+ * Units of work *
+ *****************/
+
+int job_owner(const struct mandel_job *job, int unit)
+{
+	return (unit / job->chunk) % job->nworkers;
+}
+
+int job_first_unit(const struct mandel_job *job, int worker)
+{
+	return worker * job->chunk;
+}
+
+int job_next_unit(const struct mandel_job *job, int unit)
+{
+	unit++;
+	/* end of a chunk: skip the chunks of all other workers */
+	if (unit % job->chunk == 0)
+		unit += (job->nworkers - 1) * job->chunk;
+	return unit;
+}
+
+void compute_unit(const struct mandel_job *job, int unit)
+{
+	struct viewport vp;
+	struct tile t;
+	int *dst;
+
+	if (job->ckpt && checkpoint_done(job->ckpt, unit))
+		return;
+	tile_get(&job->grid, unit, &t);
+	dst = frame_row(job->frame, t.y0) + t.x0;
+	if (job->progressive) {
+		if (job->step < job->progressive && job->ctl && render_expired(job->ctl)) {
+			__atomic_fetch_add(&job->ctl->approximated, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		compute_mandel_tile_refine(&job->vp, &t, dst, job->frame->pitch, job->step,
+					   job->step < job->progressive ? 2 * job->step : 0);
+		return;
+	}
+	if (job->ctl && render_expired(job->ctl)) {
+		vp = job->vp;
+		if (vp.max_iter > APPROX_ITER)
+			vp.max_iter = APPROX_ITER;
+		if (job->iterations)
+			compute_mandel_tile_coarse_iterations(&vp, &t, dst, job->frame->pitch,
+							      APPROX_STEP, job->vp.max_iter);
+		else
+			compute_mandel_tile_coarse(&vp, &t, dst, job->frame->pitch, APPROX_STEP);
+		__atomic_fetch_add(&job->ctl->approximated, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (job->iterations)
+		compute_mandel_tile_iterations(&job->vp, &t, dst, job->frame->pitch);
+	else if (!job->cache || cache_get(job->cache, &job->vp, &t, dst, job->frame->pitch) < 0) {
+		compute_mandel_tile(&job->vp, &t, dst, job->frame->pitch);
+		if (job->cache)
+			cache_put(job->cache, &job->vp, &t, dst, job->frame->pitch);
+	}
+	if (job->ckpt)
+		checkpoint_commit(job->ckpt, unit, &t);
+}
+
+/****************
+ * Cancellation *
+ ****************/
+
+void render_interrupt(struct render_control *ctl)
+{
+	__atomic_store_n(&ctl->interrupted, 1, __ATOMIC_RELAXED);
+}
+
+int render_expired(struct render_control *ctl)
+{
+	if (__atomic_load_n(&ctl->interrupted, __ATOMIC_RELAXED) ||
+	    __atomic_load_n(&ctl->expired, __ATOMIC_RELAXED))
+		return 1;
+	if (ctl->deadline == 0 || tune_now() < ctl->deadline)
+		return 0;
+	__atomic_store_n(&ctl->expired, 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+/**********
+ * Output *
+ **********/
+
+/*
+ * This function outputs an array of width color values
+ * to a 256-color xterm. The escape sequences are collected
+ * in a buffer, so that a line costs a handful of write()s
+ * instead of two per character.
+ */
+void output_mandel_line(int fd, const int color_val[], int width)
+{
+	char buf[OUTBUF_SIZE];
+	int i, len = 0;
+
+	for (i = 0; i < width; i++) {
+		/* Set the current color, then output the point */
+		len += snprintf(buf + len, OUTBUF_SIZE - len, "\033[38;5;%dm@", color_val[i]);
+		if (len > OUTBUF_SIZE - 32) {
+			if (insist_write(fd, buf, len) != len) {
+				perror("output_mandel_line: write points");
+				exit(1);
+			}
+			len = 0;
+		}
+	}
+
+	/* Now that the line is done, output a newline character */
+	buf[len++] = '\n';
+	if (insist_write(fd, buf, len) != len) {
+		perror("output_mandel_line: write newline");
+		exit(1);
+	}
+}
+
+void output_unit(const struct mandel_job *job, int unit)
+{
+	struct tile t;
+	int row;
+
+	tile_get(&job->grid, unit, &t);
+	if (t.tx != job->grid.tiles_x - 1)
+		return;
+	frame_rows_ready(job->frame, t.y0, t.h);
+	if (job->fd < 0)
+		return;
+	for (row = t.y0; row < t.y0 + t.h; row++)
+		output_mandel_line(job->fd, frame_row(job->frame, row), job->frame->width);
+}
+
+void output_frame(const struct mandel_job *job)
+{
+	int row;
+
+	frame_rows_ready(job->frame, 0, job->frame->height);
+	if (job->fd < 0)
+		return;
+	for (row = 0; row < job->frame->height; row++)
+		output_mandel_line(job->fd, frame_row(job->frame, row), job->frame->width);
+}
+
+/*****************
+ * NUMA locality *
+ *****************/
+
+void frame_bind_units(const struct mandel_job *job)
+{
+	long page = sysconf(_SC_PAGE_SIZE);
+	struct tile t;
+	char *start, *end;
+	int u;
+
+	if (job->topo == NULL || job->topo->nnodes <= 1)
+		return;
+
+	for (u = 0; u < job->grid.ntiles; u++) {
+		tile_get(&job->grid, u, &t);
+		if (t.w != job->frame->width)
+			continue;	/* only full-width units span whole pages */
+		start = (char *)frame_row(job->frame, t.y0);
+		end = (char *)frame_row(job->frame, t.y0 + t.h);
+		/* round inwards to whole pages */
+		start = (char *)(((unsigned long)start + page - 1) & ~(page - 1));
+		end = (char *)((unsigned long)end & ~(page - 1));
+		if (start < end)
+			affinity_bind_memory(job->topo, start, end - start,
+					     affinity_node_of_cpu(job->topo,
+								  job->cpus[job_owner(job, u)]));
+	}
+}
+
+/*****************
+ * Spawn methods *
+ *****************/
+
+int spawn_parse_method(const char *s, enum spawn_method *how)
+{
+	static const char *const names[] = { "fork", "vfork", "spawn" };
+	unsigned int i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (strcmp(s, names[i]) == 0) {
+			*how = (enum spawn_method)i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int safe_atoi(const char *s, int *val)
+{
+	long l;
+	char *endp;
+
+	errno = 0;
+	l = strtol(s, &endp, 10);
+	if (s == endp || *endp != '\0' || errno || l < INT_MIN || l > INT_MAX)
+		return -1;
+	*val = l;
+	return 0;
+}
+
+/*****************
+ * Shared memory *
+ *****************/
+
+/*
+ * Create a shared memory area, usable by all descendants of the calling
+ * process.
+ */
+void *create_shared_memory_area(unsigned int numbytes)
+{
+	int pages;
+	void *addr;
+
+	if (numbytes == 0) {
+		fprintf(stderr, "%s: internal error: called for numbytes == 0\n", __func__);
+		exit(1);
+	}
+
+	/*
+	 * Determine the number of pages needed, round up the requested number of
+	 * pages
+	 */
+	pages = (numbytes - 1) / sysconf(_SC_PAGE_SIZE) + 1;
+
+	/* Create a shared, anonymous mapping for this number of pages */
+	addr = mmap(NULL, pages * sysconf(_SC_PAGE_SIZE), PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
+	return addr;
+}
+
+void destroy_shared_memory_area(void *addr, unsigned int numbytes)
+{
+	int pages;
+
+	if (numbytes == 0) {
+		fprintf(stderr, "%s: internal error: called for numbytes == 0\n", __func__);
+		exit(1);
+	}
+
+	/*
+	 * Determine the number of pages needed, round up the requested number of
+	 * pages
+	 */
+	pages = (numbytes - 1) / sysconf(_SC_PAGE_SIZE) + 1;
+
+	if (munmap(addr, pages * sysconf(_SC_PAGE_SIZE)) == -1) {
+		perror("destroy_shared_memory_area: munmap failed");
+		exit(1);
+	}
+}
@@ -0,0 +1,127 @@
+/*
+ * render.h
+ *
+ * The work and output paths shared by all execution backends:
+ * a render job, the units of work it is split into and the
+ * ordered output of finished rows.
+ *
+ */
+
+#ifndef RENDER_H__
+#define RENDER_H__
+
+#include <stddef.h>
+
+#include "affinity.h"
+#include "cache.h"
+#include "checkpoint.h"
+#include "frame.h"
+#include "tile.h"
+
+#define MANDEL_MAX_ITERATION 100000
+
+/* How process backends start their workers */
+enum spawn_method {
+	SPAWN_FORK,
+	SPAWN_VFORK,		/* vfork() + exec of this program */
+	SPAWN_POSIX_SPAWN	/* posix_spawn() of this program */
+};
+
+/* "fork", "vfork" or "spawn"; 0 on success, -1 if unknown */
+int spawn_parse_method(const char *s, enum spawn_method *how);
+
+/* A whole decimal int, unlike atoi(); 0 on success, -1 if s is not one */
+int safe_atoi(const char *s, int *val);
+
+/*
+ * Cooperative cancellation of a render. Workers check it before each
+ * unit: once the deadline has passed or the render was interrupted,
+ * the units left are approximated instead of computed, so that the
+ * render still ends promptly with a whole, if coarser, frame.
+ *
+ * It must be in memory the workers share (create_shared_memory_area()
+ * for forked ones), and holds no pointers.
+ */
+struct render_control {
+	double deadline;	/* tune_now() time, 0 for none */
+	int interrupted;	/* set by render_interrupt() */
+	int expired;		/* the deadline was seen to pass */
+	unsigned int approximated;	/* units approximated so far */
+};
+
+/* Mark the render interrupted; async-signal-safe */
+void render_interrupt(struct render_control *ctl);
+
+/* Whether units should be approximated from now on */
+int render_expired(struct render_control *ctl);
+
+/*
+ * A render job. The frame is split into the tiles of `grid' (full-width,
+ * one-row tiles unless tiles were asked for); tile n in grid order is
+ * unit of work n. Units are handed out to workers `chunk' at a time,
+ * round-robin: unit u belongs to worker (u / chunk) % nworkers.
+ */
+struct mandel_job {
+	struct viewport vp;
+	struct tile_grid grid;
+	int nworkers;
+	int chunk;
+	const int *cpus;	/* CPU of each worker, -1 to leave unpinned */
+	int threads;		/* workers per process, for hybrid backends */
+	enum affinity_domain domain;	/* where such a process is pinned */
+	const char *farm;	/* worker addresses, comma separated, for farm */
+	struct cache *cache;	/* tiles to look up before computing, or NULL */
+	struct checkpoint *ckpt;	/* holds the frame and the units done, or NULL */
+	struct render_control *ctl;	/* deadline and interruption, or NULL */
+	int progressive;	/* coarsest step of a progressive render, or 0 */
+	int iterations;		/* store iteration counts, to be colored later */
+	int step;		/* the pass being rendered, if progressive */
+	const struct cpu_topology *topo;
+	struct frame *frame;
+	int fd;			/* output file descriptor, -1 to only compute */
+	enum spawn_method spawn;
+	double spawn_time;	/* seconds spent starting workers, if any */
+};
+
+/* Units of work */
+int job_owner(const struct mandel_job *job, int unit);
+int job_first_unit(const struct mandel_job *job, int worker);
+int job_next_unit(const struct mandel_job *job, int unit);
+
+/*
+ * Compute a unit into the frame: from the cache if it has it, otherwise
+ * in full, or approximated if the job's render_control says so. In a
+ * progressive render, only the samples new in this pass are computed,
+ * and an expired render keeps the blocks of the previous one. A job
+ * for iterations gets counts instead of colors, and skips the cache.
+ * With a checkpoint, units it has are skipped and computed ones
+ * committed to it; approximated ones are not.
+ */
+void compute_unit(const struct mandel_job *job, int unit);
+
+/*
+ * Output the rows completed by `unit': all rows of its band if it is
+ * the last unit of the band, nothing otherwise. Must be called for
+ * units in increasing order, after all previous units are computed.
+ */
+void output_unit(const struct mandel_job *job, int unit);
+
+/* Output the whole frame, once every unit is computed */
+void output_frame(const struct mandel_job *job);
+
+void output_mandel_line(int fd, const int color_val[], int width);
+
+/*
+ * Place the pages holding each worker's units on that worker's NUMA
+ * node. Pages shared by units of different workers are left alone.
+ */
+void frame_bind_units(const struct mandel_job *job);
+
+/*
+ * Create a shared memory area, usable by all descendants of the calling
+ * process.
+ */
+void *create_shared_memory_area(unsigned int numbytes);
+void destroy_shared_memory_area(void *addr, unsigned int numbytes);
+
+#endif /* RENDER_H__ */
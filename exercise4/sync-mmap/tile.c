@@ -0,0 +1,221 @@
+/*
+ * tile.c
+ *
+ * 2D tile decomposition of a frame: tile geometry and iteration
+ * order, and per-tile Mandelbrot computation.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../helpers/mandel-lib.h"
+#include "tile.h"
+
+void tile_grid_init(struct tile_grid *grid, int width, int height,
+		    int tile_w, int tile_h, enum tile_order order)
+{
+	grid->width = width;
+	grid->height = height;
+	grid->tile_w = tile_w < width ? tile_w : width;
+	grid->tile_h = tile_h < height ? tile_h : height;
+	grid->tiles_x = (width + grid->tile_w - 1) / grid->tile_w;
+	grid->tiles_y = (height + grid->tile_h - 1) / grid->tile_h;
+	grid->ntiles = grid->tiles_x * grid->tiles_y;
+	grid->order = order;
+}
+
+void tile_get(const struct tile_grid *grid, int n, struct tile *t)
+{
+	switch (grid->order) {
+	case TILE_ORDER_COLUMNS:
+		t->tx = n / grid->tiles_y;
+		t->ty = n % grid->tiles_y;
+		break;
+	case TILE_ORDER_SERPENTINE:
+		t->ty = n / grid->tiles_x;
+		t->tx = n % grid->tiles_x;
+		if (t->ty % 2)
+			t->tx = grid->tiles_x - 1 - t->tx;
+		break;
+	case TILE_ORDER_ROWS:
+	default:
+		t->ty = n / grid->tiles_x;
+		t->tx = n % grid->tiles_x;
+		break;
+	}
+
+	t->x0 = t->tx * grid->tile_w;
+	t->y0 = t->ty * grid->tile_h;
+	t->w = grid->width - t->x0 < grid->tile_w ? grid->width - t->x0 : grid->tile_w;
+	t->h = grid->height - t->y0 < grid->tile_h ? grid->height - t->y0 : grid->tile_h;
+}
+
+int tile_parse_size(const char *s, int *tile_w, int *tile_h)
+{
+	char c;
+
+	if (sscanf(s, "%dx%d%c", tile_w, tile_h, &c) != 2 || *tile_w <= 0 || *tile_h <= 0)
+		return -1;
+	return 0;
+}
+
+int tile_parse_order(const char *s, enum tile_order *order)
+{
+	if (strcmp(s, "rows") == 0)
+		*order = TILE_ORDER_ROWS;
+	else if (strcmp(s, "columns") == 0)
+		*order = TILE_ORDER_COLUMNS;
+	else if (strcmp(s, "serpentine") == 0)
+		*order = TILE_ORDER_SERPENTINE;
+	else
+		return -1;
+	return 0;
+}
+
+/*
+ * xterm_color() searches the palette for the nearest color every time
+ * it is called, rebuilding a static table of mandel-lib's as it goes;
+ * there are only 256 answers, so they are worked out once, by a single
+ * thread, and kept here. Nothing else calls xterm_color(), so threads
+ * never write mandel-lib's table at the same time either.
+ */
+static unsigned char color_table[256];
+static pthread_once_t color_table_once = PTHREAD_ONCE_INIT;
+
+static void fill_color_table(void)
+{
+	int i;
+
+	for (i = 0; i < 256; i++)
+		color_table[i] = xterm_color(i);
+}
+
+static const unsigned char *colors(void)
+{
+	pthread_once(&color_table_once, fill_color_table);
+	return color_table;
+}
+
+double tile_xstart(const struct viewport *vp, const struct tile *t)
+{
+	double x;
+	int i;
+
+	/*
+	 * Step x the same way compute_mandel_line() does, so that a frame
+	 * drawn in tiles is identical to one drawn in full rows.
+	 */
+	for (x = vp->xmin, i = 0; i < t->x0; i++)
+		x += vp->xstep;
+	return x;
+}
+
+int mandel_color(double x, double y, int max_iter)
+{
+	return mandel_palette(mandel_iterations_at_point(x, y, max_iter));
+}
+
+int mandel_palette(int val)
+{
+	return colors()[val > 255 ? 255 : val];
+}
+
+void compute_mandel_tile(const struct viewport *vp, const struct tile *t,
+			 int *dst, size_t pitch)
+{
+	const unsigned char *color = colors();
+	double x, y, xstart = tile_xstart(vp, t);
+	int i, j, val;
+
+	for (j = 0; j < t->h; j++, dst += pitch) {
+		y = vp->ymax - vp->ystep * (t->y0 + j);
+		for (x = xstart, i = 0; i < t->w; x += vp->xstep, i++) {
+			val = mandel_iterations_at_point(x, y, vp->max_iter);
+			if (val > 255)
+				val = 255;
+			dst[i] = color[val];
+		}
+	}
+}
+
+/*
+ * Fill each step x step block with the color of its top left sample,
+ * or with its iteration count if color is NULL (`inside' for samples
+ * that reach the cap).
+ */
+static void fill_coarse(const struct viewport *vp, const struct tile *t, int *dst, size_t pitch,
+			int step, const unsigned char *color, int inside)
+{
+	double x, y, xstart = tile_xstart(vp, t);
+	int i, j, k, l, val;
+
+	for (j = 0; j < t->h; j += step) {
+		y = vp->ymax - vp->ystep * (t->y0 + j);
+		/* step x over every column, so samples are where they'd be */
+		for (x = xstart, i = 0; i < t->w; x += vp->xstep, i++) {
+			if (i % step)
+				continue;
+			val = mandel_iterations_at_point(x, y, vp->max_iter);
+			if (color)
+				val = color[val > 255 ? 255 : val];
+			else if (val == vp->max_iter)
+				val = inside;
+			for (l = j; l < j + step && l < t->h; l++)
+				for (k = i; k < i + step && k < t->w; k++)
+					dst[l * pitch + k] = val;
+		}
+	}
+}
+
+void compute_mandel_tile_coarse(const struct viewport *vp, const struct tile *t,
+				int *dst, size_t pitch, int step)
+{
+	fill_coarse(vp, t, dst, pitch, step, colors(), 0);
+}
+
+void compute_mandel_tile_iterations(const struct viewport *vp, const struct tile *t,
+				    int *dst, size_t pitch)
+{
+	double x, y, xstart = tile_xstart(vp, t);
+	int i, j;
+
+	for (j = 0; j < t->h; j++, dst += pitch) {
+		y = vp->ymax - vp->ystep * (t->y0 + j);
+		for (x = xstart, i = 0; i < t->w; x += vp->xstep, i++)
+			dst[i] = mandel_iterations_at_point(x, y, vp->max_iter);
+	}
+}
+
+void compute_mandel_tile_coarse_iterations(const struct viewport *vp, const struct tile *t,
+					   int *dst, size_t pitch, int step, int inside)
+{
+	fill_coarse(vp, t, dst, pitch, step, NULL, inside);
+}
+
+void compute_mandel_tile_refine(const struct viewport *vp, const struct tile *t,
+				int *dst, size_t pitch, int step, int skip)
+{
+	const unsigned char *color = colors();
+	double x, y, xstart = tile_xstart(vp, t);
+	int i, j, k, l, val, old_row;
+
+	for (j = 0; j < t->h; j += step) {
+		y = vp->ymax - vp->ystep * (t->y0 + j);
+		old_row = skip && (t->y0 + j) % skip == 0;
+		for (x = xstart, i = 0; i < t->w; x += vp->xstep, i++) {
+			if (i % step || (old_row && (t->x0 + i) % skip == 0))
+				continue;
+			val = mandel_iterations_at_point(x, y, vp->max_iter);
+			if (val > 255)
+				val = 255;
+			val = color[val];
+			for (l = j; l < j + step && l < t->h; l++)
+				for (k = i; k < i + step && k < t->w; k++)
+					dst[l * pitch + k] = val;
+		}
+	}
+}
@@ -0,0 +1,109 @@
+/*
+ * tile.h
+ *
+ * 2D tile decomposition of a frame: tile geometry and iteration
+ * order, and per-tile Mandelbrot computation.
+ *
+ * Nothing here has global state but a table of xterm colors, filled
+ * once (pthread_once()) on first use; all functions may be called
+ * concurrently from threads or forked processes. Nothing else may call
+ * mandel-lib's xterm_color(), which is not thread-safe.
+ *
+ */
+
+#ifndef TILE_H__
+#define TILE_H__
+
+#include <stddef.h>
+
+/* The part of the complex plane being drawn and how finely */
+struct viewport {
+	double xmin, ymax;	/* upper left corner */
+	double xstep, ystep;	/* size of one output character */
+	int max_iter;
+};
+
+/* Order in which tile_get() enumerates the tiles of a grid */
+enum tile_order {
+	TILE_ORDER_ROWS,	/* left to right, top to bottom */
+	TILE_ORDER_COLUMNS,	/* top to bottom, left to right */
+	TILE_ORDER_SERPENTINE	/* rows, alternating direction */
+};
+
+struct tile_grid {
+	int width, height;	/* frame size in characters */
+	int tile_w, tile_h;
+	int tiles_x, tiles_y;
+	int ntiles;
+	enum tile_order order;
+};
+
+struct tile {
+	int tx, ty;		/* position in the grid */
+	int x0, y0;		/* top left pixel in the frame */
+	int w, h;		/* smaller than tile_w x tile_h at the edges */
+};
+
+void tile_grid_init(struct tile_grid *grid, int width, int height,
+		    int tile_w, int tile_h, enum tile_order order);
+
+/* The n-th tile of the grid, 0 <= n < ntiles, in grid->order */
+void tile_get(const struct tile_grid *grid, int n, struct tile *t);
+
+/* Parse "WxH" and an order name; both return 0 on success, -1 otherwise */
+int tile_parse_size(const char *s, int *tile_w, int *tile_h);
+int tile_parse_order(const char *s, enum tile_order *order);
+
+/* The x coordinate of the tile's left column, exactly as it is drawn */
+double tile_xstart(const struct viewport *vp, const struct tile *t);
+
+/*
+ * Compute the xterm color values of a tile. dst points to where pixel
+ * (t->x0, t->y0) is stored and pitch is the distance in ints between
+ * vertically adjacent pixels, so tiles can be written straight into a
+ * frame (dst = frame + y0 * width + x0, pitch = width) or into a
+ * compact tile buffer (pitch = t->w).
+ */
+void compute_mandel_tile(const struct viewport *vp, const struct tile *t,
+			 int *dst, size_t pitch);
+
+/* The xterm color value of one point, for samples not on a tile's grid */
+int mandel_color(double x, double y, int max_iter);
+
+/* The xterm color of palette entry val, what val iterations are drawn in */
+int mandel_palette(int val);
+
+/*
+ * A cheap stand-in for compute_mandel_tile(): only every step-th pixel
+ * of every step-th row, counting from the tile's top left corner, is
+ * computed (exactly as compute_mandel_tile() would compute it), and
+ * its color fills the step x step block it is the top left corner of.
+ */
+void compute_mandel_tile_coarse(const struct viewport *vp, const struct tile *t,
+				int *dst, size_t pitch, int step);
+
+/*
+ * compute_mandel_tile() and compute_mandel_tile_coarse(), storing the
+ * iteration counts themselves (up to vp->max_iter) instead of colors,
+ * for colorings that need the whole frame first (see equalize.h).
+ * Coarse samples that reach the cap are stored as `inside', so that
+ * samples taken with a lower cap still read as not escaping.
+ */
+void compute_mandel_tile_iterations(const struct viewport *vp, const struct tile *t,
+				    int *dst, size_t pitch);
+void compute_mandel_tile_coarse_iterations(const struct viewport *vp, const struct tile *t,
+					   int *dst, size_t pitch, int step, int inside);
+
+/*
+ * One pass of a progressive render: compute the pixels of the tile
+ * whose frame coordinates are both multiples of step, except those
+ * that are both multiples of skip (done by the previous pass; skip 0
+ * for the first pass), and fill the step x step block of each with
+ * its color. The tile must start at multiples of step. Passes with
+ * step = 8, 4, 2, 1 compute every pixel once, as compute_mandel_tile()
+ * would.
+ */
+void compute_mandel_tile_refine(const struct viewport *vp, const struct tile *t,
+				int *dst, size_t pitch, int step, int skip);
+
+#endif /* TILE_H__ */
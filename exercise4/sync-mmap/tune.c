@@ -0,0 +1,212 @@
+/*
+ * tune.c
+ *
+ * Runtime auto-tuning of the worker count and the chunk size (rows
+ * handed to a worker at a time), with the result cached in a small
+ * config file keyed by CPU model, resolution, tiles and iteration cap.
+ *
+ * The cache file holds one line per key:
+ *	<key> TAB <workers> <chunk> <seconds>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tune.h"
+
+#define LINELEN		512
+#define CPUINFO_PATH	"/proc/cpuinfo"
+
+double tune_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The "model name" line of /proc/cpuinfo, or "unknown" */
+static void cpu_model(char *buf, size_t len)
+{
+	char line[LINELEN];
+	char *p;
+	FILE *f;
+
+	snprintf(buf, len, "unknown");
+	f = fopen(CPUINFO_PATH, "r");
+	if (!f)
+		return;
+	while (fgets(line, LINELEN, f) != NULL) {
+		if (strncmp(line, "model name", 10) != 0)
+			continue;
+		p = strchr(line, ':');
+		if (!p)
+			continue;
+		for (p++; *p == ' '; p++)
+			;
+		p[strcspn(p, "\n")] = '\0';
+		snprintf(buf, len, "%s", p);
+		break;
+	}
+	fclose(f);
+}
+
+void tune_make_key(char *key, size_t len, const char *tag, int width, int height,
+		   int tile_w, int tile_h, int max_iter)
+{
+	char model[TUNE_KEYLEN];
+
+	cpu_model(model, sizeof(model));
+	/* the key is tab-terminated in the cache file, keep it tab-free */
+	model[strcspn(model, "\t")] = '\0';
+	snprintf(key, len, "%s/%ldcpu/%dx%d/%dx%d/%d/%s", model,
+		 sysconf(_SC_NPROCESSORS_ONLN), width, height, tile_w, tile_h, max_iter, tag);
+}
+
+static int cache_path(char *buf, size_t len)
+{
+	const char *env;
+
+	if ((env = getenv("MANDEL_TUNE_FILE")) != NULL) {
+		snprintf(buf, len, "%s", env);
+		return 0;
+	}
+	if ((env = getenv("HOME")) != NULL) {
+		snprintf(buf, len, "%s/.mandel-tune", env);
+		return 0;
+	}
+	return -1;
+}
+
+/* If line starts with "key\t", return a pointer past the tab */
+static char *match_key(char *line, const char *key)
+{
+	size_t n = strlen(key);
+
+	if (strncmp(line, key, n) == 0 && line[n] == '\t')
+		return line + n + 1;
+	return NULL;
+}
+
+int tune_lookup(const char *key, struct tune_result *res)
+{
+	char path[LINELEN], line[LINELEN];
+	char *p;
+	FILE *f;
+	int ret = -1;
+
+	if (cache_path(path, sizeof(path)) < 0 || (f = fopen(path, "r")) == NULL)
+		return -1;
+	while (fgets(line, LINELEN, f) != NULL) {
+		if ((p = match_key(line, key)) == NULL)
+			continue;
+		if (sscanf(p, "%d %d %lf", &res->workers, &res->chunk, &res->seconds) == 3 &&
+		    res->workers > 0 && res->chunk > 0)
+			ret = 0;
+	}
+	fclose(f);
+	return ret;
+}
+
+int tune_store(const char *key, const struct tune_result *res)
+{
+	char path[LINELEN], tmp[LINELEN + 24], line[LINELEN];
+	FILE *in, *out;
+
+	if (cache_path(path, sizeof(path)) < 0)
+		return -1;
+	snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+	if ((out = fopen(tmp, "w")) == NULL) {
+		perror(tmp);
+		return -1;
+	}
+
+	/* Copy all other keys, then append ours; rename() makes it atomic */
+	if ((in = fopen(path, "r")) != NULL) {
+		while (fgets(line, LINELEN, in) != NULL)
+			if (!match_key(line, key))
+				fputs(line, out);
+		fclose(in);
+	}
+	fprintf(out, "%s\t%d %d %.6f\n", key, res->workers, res->chunk, res->seconds);
+
+	if (fclose(out) != 0 || rename(tmp, path) < 0) {
+		perror(path);
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/* 0 once tried, -1 if the render asked to abort the search */
+static int try_config(tune_render_fn render, void *arg, int workers, int chunk,
+		      struct tune_result *best)
+{
+	double t;
+
+	t = render(workers, chunk, arg);
+	if (t == TUNE_ABORT) {
+		fprintf(stderr, "tune: %3d workers, chunk %3d: aborted\n", workers, chunk);
+		return -1;
+	}
+	fprintf(stderr, "tune: %3d workers, chunk %3d: %.4fs\n", workers, chunk, t);
+	if (t >= 0 && (best->workers == 0 || t < best->seconds)) {
+		best->workers = workers;
+		best->chunk = chunk;
+		best->seconds = t;
+	}
+	return 0;
+}
+
+int tune_search(tune_render_fn render, void *arg, int max_chunk,
+		struct tune_result *best)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int workers, chunk, ret = 0;
+
+	if (ncpus < 1)
+		ncpus = 1;
+	best->workers = 0;
+	best->chunk = 1;
+	best->seconds = 0;
+
+	for (workers = 1; workers <= 2 * ncpus && ret == 0; workers *= 2) {
+		for (chunk = 1; chunk <= max_chunk && ret == 0; chunk *= 2)
+			ret = try_config(render, arg, workers, chunk, best);
+		/* also try exactly one worker per CPU */
+		if (workers < ncpus && 2 * workers > ncpus)
+			for (chunk = 1; chunk <= max_chunk && ret == 0; chunk *= 2)
+				ret = try_config(render, arg, ncpus, chunk, best);
+	}
+
+	if (best->workers == 0) {
+		best->workers = ncpus;
+		return -1;
+	}
+	return ret;
+}
+
+void tune_get(const char *key, tune_render_fn render, void *arg, int max_chunk,
+	      struct tune_result *res)
+{
+	if (tune_lookup(key, res) == 0) {
+		fprintf(stderr, "tune: using cached %d workers, chunk %d\n",
+			res->workers, res->chunk);
+		return;
+	}
+
+	fprintf(stderr, "tune: no cached settings for `%s', calibrating\n", key);
+	if (tune_search(render, arg, max_chunk, res) < 0) {
+		/* a guess, or the best of part of the grid: not for the cache */
+		fprintf(stderr, "tune: calibration incomplete, using %d workers, chunk %d"
+			" without caching them\n", res->workers, res->chunk);
+		return;
+	}
+	fprintf(stderr, "tune: best is %d workers, chunk %d (%.4fs)\n",
+		res->workers, res->chunk, res->seconds);
+	tune_store(key, res);
+}
@@ -0,0 +1,71 @@
+/*
+ * tune.h
+ *
+ * Runtime auto-tuning of the worker count and the chunk size (rows
+ * handed to a worker at a time), with the result cached in a small
+ * config file keyed by CPU model, resolution, tiles and iteration cap.
+ *
+ */
+
+#ifndef TUNE_H__
+#define TUNE_H__
+
+#include <stddef.h>
+
+#define TUNE_KEYLEN	256
+
+struct tune_result {
+	int workers;
+	int chunk;
+	double seconds;		/* time of the best calibration render */
+};
+
+/*
+ * A calibration render: render the frame with the given worker count
+ * and chunk size and return the elapsed wall-clock time in seconds,
+ * a negative value on failure, or TUNE_ABORT to end the calibration
+ * (e.g. on Ctrl-C) without trying the configurations left.
+ */
+typedef double (*tune_render_fn)(int workers, int chunk, void *arg);
+
+#define TUNE_ABORT	-2.0
+
+/*
+ * Build the cache key for this machine, a width x height frame cut
+ * into tile_w x tile_h units (the chunk counts them), the iteration
+ * cap and a tag telling apart settings tuned for different renderers.
+ */
+void tune_make_key(char *key, size_t len, const char *tag, int width, int height,
+		   int tile_w, int tile_h, int max_iter);
+
+/*
+ * Look up / store a tuned result in the cache file, which is
+ * $MANDEL_TUNE_FILE if set, otherwise $HOME/.mandel-tune.
+ * Both return 0 on success, -1 on a miss or failure.
+ */
+int tune_lookup(const char *key, struct tune_result *res);
+int tune_store(const char *key, const struct tune_result *res);
+
+/*
+ * Time calibration renders over a grid of worker counts (powers of two
+ * up to twice the online CPUs, plus the CPU count itself) and chunk
+ * sizes (powers of two up to max_chunk), and return the fastest in
+ * best. Returns 0 if the whole grid was tried and some configuration
+ * measured, -1 if the search was aborted or every render failed; best
+ * then holds the fastest measured, or the CPU count and chunk 1.
+ */
+int tune_search(tune_render_fn render, void *arg, int max_chunk,
+		struct tune_result *best);
+
+/*
+ * Return the tuned settings for key, running tune_search() and storing
+ * the result on a cache miss, unless the search failed. Progress is
+ * reported on stderr.
+ */
+void tune_get(const char *key, tune_render_fn render, void *arg, int max_chunk,
+	      struct tune_result *res);
+
+/* Monotonic wall-clock time in seconds, for timing renders. */
+double tune_now(void);
+
+#endif /* TUNE_H__ */
@@ -0,0 +1,138 @@
+/*
+ * workq.c
+ *
+ * A work queue in a shared memory area, for handing out units of work
+ * to forked children dynamically: an atomic `next unit' counter that
+ * children pull chunks from, and a completion flag per unit that the
+ * printing process can sleep on (a futex).
+ *
+ * Children that are fast (or get more CPU) simply take more chunks,
+ * so a slow child no longer holds up a fixed share of the rows.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "render.h"
+#include "workq.h"
+
+/*
+ * The futexes live in MAP_SHARED memory and are waited on across
+ * processes, so the non-private FUTEX_WAIT / FUTEX_WAKE are used.
+ */
+int futex_wait_timeout(unsigned int *addr, unsigned int val, int ms)
+{
+	struct timespec ts = { ms / 1000, ms % 1000 * 1000000L };
+
+	if (syscall(SYS_futex, addr, FUTEX_WAIT, val, ms < 0 ? NULL : &ts, NULL, 0) < 0) {
+		if (errno == ETIMEDOUT)
+			return -1;
+		if (errno != EAGAIN && errno != EINTR) {
+			perror("futex_wait");
+			exit(1);
+		}
+	}
+	return 0;
+}
+
+void futex_wait(unsigned int *addr, unsigned int val)
+{
+	futex_wait_timeout(addr, val, -1);
+}
+
+void futex_wake(unsigned int *addr, int n)
+{
+	if (syscall(SYS_futex, addr, FUTEX_WAKE, n, NULL, NULL, 0) < 0) {
+		perror("futex_wake");
+		exit(1);
+	}
+}
+
+unsigned int workq_size(int nunits)
+{
+	return sizeof(struct workq) + nunits * sizeof(unsigned int);
+}
+
+struct workq *workq_create(int nunits, int chunk)
+{
+	struct workq *q;
+
+	q = create_shared_memory_area(workq_size(nunits));
+	workq_init(q, nunits, chunk);
+	return q;
+}
+
+void workq_init(struct workq *q, int nunits, int chunk)
+{
+	memset(q->done, 0, nunits * sizeof(q->done[0]));
+	q->next = 0;
+	q->nunits = nunits;
+	q->chunk = chunk;
+	q->sleeping = 0;
+}
+
+void workq_destroy(struct workq *q)
+{
+	destroy_shared_memory_area(q, workq_size(q->nunits));
+}
+
+int workq_take(struct workq *q, int *first, int *last)
+{
+	unsigned int u;
+
+	/* relaxed is enough: the counter orders nothing but itself */
+	u = __atomic_fetch_add(&q->next, q->chunk, __ATOMIC_RELAXED);
+	if (u >= q->nunits)
+		return -1;
+	*first = u;
+	*last = u + q->chunk < q->nunits ? u + q->chunk : q->nunits;
+	return 0;
+}
+
+void workq_complete(struct workq *q, int unit)
+{
+	/*
+	 * The unit's pixels are written before the flag. Flag and
+	 * `sleeping' are sequentially consistent against the same pair in
+	 * workq_wait(), so either the waiter sees the flag or we see the
+	 * waiter; the system call is only made when someone sleeps.
+	 */
+	__atomic_store_n(&q->done[unit], 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->sleeping, __ATOMIC_SEQ_CST))
+		futex_wake(&q->done[unit], 1);
+}
+
+int workq_is_done(struct workq *q, int unit)
+{
+	return __atomic_load_n(&q->done[unit], __ATOMIC_ACQUIRE);
+}
+
+int workq_wait_timeout(struct workq *q, int unit, int ms)
+{
+	int ret = 0;
+
+	if (workq_is_done(q, unit))
+		return 0;
+
+	__atomic_store_n(&q->sleeping, 1, __ATOMIC_SEQ_CST);
+	/* FUTEX_WAIT returns at once if the flag was set meanwhile */
+	while (!__atomic_load_n(&q->done[unit], __ATOMIC_SEQ_CST))
+		if (futex_wait_timeout(&q->done[unit], 0, ms) < 0) {
+			ret = __atomic_load_n(&q->done[unit], __ATOMIC_SEQ_CST) ? 0 : -1;
+			break;
+		}
+	__atomic_store_n(&q->sleeping, 0, __ATOMIC_RELAXED);
+	return ret;
+}
+
+void workq_wait(struct workq *q, int unit)
+{
+	workq_wait_timeout(q, unit, -1);
+}
@@ -0,0 +1,59 @@
+/*
+ * workq.h
+ *
+ * A work queue in a shared memory area, for handing out units of work
+ * to forked children dynamically: an atomic `next unit' counter that
+ * children pull chunks from, and a completion flag per unit that the
+ * printing process can sleep on (a futex).
+ *
+ */
+
+#ifndef WORKQ_H__
+#define WORKQ_H__
+
+struct workq {
+	unsigned int next;		/* next unit to hand out */
+	unsigned int nunits;
+	unsigned int chunk;		/* units handed out at a time */
+	unsigned int sleeping;		/* someone is in workq_wait() */
+	unsigned int done[];		/* completion flag of every unit */
+};
+
+/* Create / destroy a queue in a shared memory area */
+struct workq *workq_create(int nunits, int chunk);
+void workq_destroy(struct workq *q);
+
+/* Bytes needed for a queue of nunits, and (re)initialization in place */
+unsigned int workq_size(int nunits);
+void workq_init(struct workq *q, int nunits, int chunk);
+
+/*
+ * Take the next chunk: units [*first, *last). Returns 0 on success,
+ * -1 when all units have been handed out.
+ */
+int workq_take(struct workq *q, int *first, int *last);
+
+/* Mark a unit as computed; its results are visible to whoever sees it done */
+void workq_complete(struct workq *q, int unit);
+int workq_is_done(struct workq *q, int unit);
+
+/* Sleep until a unit is complete */
+void workq_wait(struct workq *q, int unit);
+
+/*
+ * The same for at most ms milliseconds, so that the waiter can check
+ * on whoever should complete the unit; returns -1 if it is still not
+ * complete by then, 0 otherwise.
+ */
+int workq_wait_timeout(struct workq *q, int unit, int ms);
+
+/*
+ * Process-shared futex operations: sleep while *addr == val (at most
+ * ms milliseconds if ms >= 0, returning -1 if that runs out and 0
+ * otherwise), wake up to n sleepers.
+ */
+void futex_wait(unsigned int *addr, unsigned int val);
+int futex_wait_timeout(unsigned int *addr, unsigned int val, int ms);
+void futex_wake(unsigned int *addr, int n);
+
+#endif /* WORKQ_H__ */